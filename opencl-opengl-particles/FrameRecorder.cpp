@@ -0,0 +1,259 @@
+//
+//  FrameRecorder.cpp
+//  opencl-opengl-particles
+//
+//
+
+#include "FrameRecorder.hpp"
+
+#include <GLFW/glfw3.h>
+
+#include <string.h>
+#include <algorithm>
+
+FrameRecorder::~FrameRecorder()
+{
+    this->finish();
+}
+
+bool FrameRecorder::initialize(unsigned int number_of_encode_threads)
+{
+    glGenRenderbuffers(1, &m_colour_renderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_colour_renderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, m_width, m_height);
+    
+    glGenRenderbuffers(1, &m_depth_renderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depth_renderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, m_width, m_height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    
+    glGenFramebuffers(1, &m_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colour_renderbuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depth_renderbuffer);
+    
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        printf("Frame recorder framebuffer incomplete (0x%x) at %ux%u\n", status, m_width, m_height);
+        return false;
+    }
+    
+    for (ReadbackSlot &slot : m_slots) {
+        glGenBuffers(1, &slot.pixel_buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixel_buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, m_width * m_height * 4, NULL, GL_STREAM_READ);
+    }
+    
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    
+    for (unsigned int i = 0; i < std::max(number_of_encode_threads, 1u); i++)
+        m_encode_threads.push_back(std::thread(&FrameRecorder::encode_loop, this));
+    
+    m_start_time = glfwGetTime();
+    
+    printf("Rendering %ux%u frames to %s*.ppm with %zu encode threads\n", m_width, m_height, m_path_prefix.c_str(), m_encode_threads.size());
+    
+    return true;
+}
+
+void FrameRecorder::begin_frame()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glViewport(0, 0, m_width, m_height);
+}
+
+void FrameRecorder::end_frame()
+{
+    ReadbackSlot &slot = m_slots[m_frame % FRAME_RECORDER_RING_SIZE];
+    
+    // The slot's previous frame was queued a whole ring ago, it has long finished.
+    if (slot.frame >= 0)
+        this->collect(slot);
+    
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    
+    // Into the bound pixel buffer, so this returns without waiting for the copy.
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixel_buffer);
+    glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.frame = m_frame++;
+    
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void FrameRecorder::collect(ReadbackSlot &slot)
+{
+    glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    glDeleteSync(slot.fence);
+    
+    EncodeJob job;
+    job.frame = slot.frame;
+    
+    {
+        std::unique_lock<std::mutex> lock(m_encode_mutex);
+        
+        // Backpressure, when encoding falls behind rendering waits rather than buffering without bound.
+        m_encode_done_condition.wait(lock, [this]{ return m_encode_jobs.size() < 2 * m_encode_threads.size(); });
+        
+        if (!m_free_pixel_buffers.empty()) {
+            job.pixels.swap(m_free_pixel_buffers.back());
+            m_free_pixel_buffers.pop_back();
+        }
+    }
+    
+    job.pixels.resize(m_width * m_height * 4);
+    
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixel_buffer);
+    
+    void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, job.pixels.size(), GL_MAP_READ_BIT);
+    
+    if (pixels != NULL) {
+        memcpy(job.pixels.data(), pixels, job.pixels.size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    
+    int frame = slot.frame;
+    
+    slot.fence = 0;
+    slot.frame = -1;
+    
+    // A frame that could not be read back is dropped, never written out as garbage.
+    if (pixels == NULL) {
+        printf("Failed to map pixel buffer for frame %d (GL error 0x%x), skipping it\n", frame, glGetError());
+        
+        std::lock_guard<std::mutex> lock(m_encode_mutex);
+        
+        m_free_pixel_buffers.push_back(std::move(job.pixels));
+        
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(m_encode_mutex);
+        
+        m_encode_jobs.push_back(std::move(job));
+    }
+    
+    m_encode_condition.notify_one();
+}
+
+void FrameRecorder::encode_loop()
+{
+    while (true) {
+        
+        EncodeJob job;
+        
+        {
+            std::unique_lock<std::mutex> lock(m_encode_mutex);
+            
+            m_encode_condition.wait(lock, [this]{ return m_is_stopping || !m_encode_jobs.empty(); });
+            
+            if (m_encode_jobs.empty())
+                return;
+            
+            job = std::move(m_encode_jobs.front());
+            m_encode_jobs.pop_front();
+        }
+        
+        m_encode_done_condition.notify_one();
+        
+        this->encode(job);
+        
+        {
+            std::lock_guard<std::mutex> lock(m_encode_mutex);
+            
+            m_encoded_frames++;
+            m_free_pixel_buffers.push_back(std::move(job.pixels));
+        }
+    }
+}
+
+void FrameRecorder::encode(const EncodeJob &job)
+{
+    // Binary PPM, flipped as GL reads bottom up, ffmpeg takes the sequence directly.
+    std::vector<unsigned char> rgb(m_width * m_height * 3);
+    
+    for (unsigned int y = 0; y < m_height; y++) {
+        
+        const unsigned char *source = &job.pixels[(m_height - 1 - y) * m_width * 4];
+        unsigned char *destination = &rgb[y * m_width * 3];
+        
+        for (unsigned int x = 0; x < m_width; x++) {
+            destination[x * 3] = source[x * 4];
+            destination[x * 3 + 1] = source[x * 4 + 1];
+            destination[x * 3 + 2] = source[x * 4 + 2];
+        }
+    }
+    
+    char path[1024];
+    snprintf(path, sizeof(path), "%s%06d.ppm", m_path_prefix.c_str(), job.frame);
+    
+    FILE *file = fopen(path, "wb");
+    
+    if (file == NULL) {
+        printf("Failed to open frame %s\n", path);
+        return;
+    }
+    
+    fprintf(file, "P6\n%u %u\n255\n", m_width, m_height);
+    fwrite(rgb.data(), 1, rgb.size(), file);
+    fclose(file);
+}
+
+void FrameRecorder::finish()
+{
+    if (m_encode_threads.empty())
+        return;
+    
+    // Collect whatever is still in flight, oldest first.
+    for (int i = 0; i < FRAME_RECORDER_RING_SIZE; i++) {
+        
+        ReadbackSlot &slot = m_slots[(m_frame + i) % FRAME_RECORDER_RING_SIZE];
+        
+        if (slot.frame >= 0)
+            this->collect(slot);
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(m_encode_mutex);
+        
+        m_is_stopping = true;
+    }
+    
+    m_encode_condition.notify_all();
+    
+    for (std::thread &thread : m_encode_threads)
+        thread.join();
+    
+    m_encode_threads.clear();
+    
+    double elapsed_time = glfwGetTime() - m_start_time;
+    
+    printf("Rendered %d frames in %f s [%f FPS], %u written\n", m_frame, elapsed_time, m_frame / elapsed_time, m_encoded_frames);
+    
+    for (ReadbackSlot &slot : m_slots)
+        glDeleteBuffers(1, &slot.pixel_buffer);
+    
+    glDeleteFramebuffers(1, &m_framebuffer);
+    glDeleteRenderbuffers(1, &m_depth_renderbuffer);
+    glDeleteRenderbuffers(1, &m_colour_renderbuffer);
+}
+
+unsigned int FrameRecorder::get_width()
+{
+    return m_width;
+}
+
+unsigned int FrameRecorder::get_height()
+{
+    return m_height;
+}
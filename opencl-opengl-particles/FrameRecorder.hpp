@@ -0,0 +1,92 @@
+//
+//  FrameRecorder.hpp
+//  opencl-opengl-particles
+//
+//  Offline rendering into an image sequence. Frames are drawn into an FBO
+//  at any resolution and read back through a ring of pixel buffer objects,
+//  so the GPU is never stalled waiting for the CPU. Encoding and writing
+//  happen on worker threads.
+//
+
+#ifndef FrameRecorder_hpp
+#define FrameRecorder_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <GL/glew.h>
+
+#define FRAME_RECORDER_RING_SIZE 3
+
+class FrameRecorder
+{
+private:
+    
+    struct ReadbackSlot
+    {
+        GLuint pixel_buffer = 0;
+        GLsync fence = 0;
+        int frame = -1;
+    };
+    
+    struct EncodeJob
+    {
+        int frame;
+        std::vector<unsigned char> pixels;
+    };
+    
+    unsigned int m_width;
+    unsigned int m_height;
+    std::string m_path_prefix;
+    
+    GLuint m_framebuffer = 0;
+    GLuint m_colour_renderbuffer = 0;
+    GLuint m_depth_renderbuffer = 0;
+    
+    ReadbackSlot m_slots[FRAME_RECORDER_RING_SIZE];
+    int m_frame = 0;
+    
+    std::vector<std::thread> m_encode_threads;
+    std::mutex m_encode_mutex;
+    std::condition_variable m_encode_condition;
+    std::condition_variable m_encode_done_condition;
+    std::deque<EncodeJob> m_encode_jobs;
+    std::vector<std::vector<unsigned char>> m_free_pixel_buffers;
+    bool m_is_stopping = false;
+    unsigned int m_encoded_frames = 0;
+    
+    double m_start_time;
+    
+    void collect(ReadbackSlot &slot);
+    void encode_loop();
+    void encode(const EncodeJob &job);
+    
+public:
+    
+    FrameRecorder(unsigned int width, unsigned int height, std::string path_prefix)
+    {
+        m_width = width;
+        m_height = height;
+        m_path_prefix = path_prefix;
+    }
+    
+    ~FrameRecorder();
+    
+    bool initialize(unsigned int number_of_encode_threads);
+    
+    // Bind the FBO before the scene draws, and read it back after.
+    void begin_frame();
+    void end_frame();
+    
+    // Drains the ring and the encoders, then reports the frame rate.
+    void finish();
+    
+    unsigned int get_width();
+    unsigned int get_height();
+};
+
+#endif /* FrameRecorder_hpp */
@@ -0,0 +1,246 @@
+//
+//  ObstacleField.cpp
+//  opencl-opengl-particles
+//
+//
+
+#include "ObstacleField.hpp"
+#include "Utility.hpp"
+#include "OpenCLRuntime.hpp"
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+ObstacleField::~ObstacleField()
+{
+    if (m_texture_id == 0)
+        return;
+    
+    clFinish(m_cl_cmd_queue);
+    
+    clReleaseMemObject(m_cl_obstacle_image);
+    clReleaseKernel(m_cl_krnl_bake_gradient);
+    clReleaseKernel(m_cl_krnl_bake_distance);
+    
+    glDeleteTextures(1, &m_texture_id);
+}
+
+void ObstacleField::initialize(cl_context context, cl_command_queue cmd_queue, cl_program program)
+{
+    cl_int cl_error;
+    
+    m_cl_cmd_queue = cmd_queue;
+    
+    create_kernels(program);
+    
+    // Start far from everything so nothing collides until the first bake.
+    std::vector<GLfloat> pixels(m_resolution * m_resolution * m_resolution * 4, 1.0f);
+    
+    glGenTextures(1, &m_texture_id);
+    glBindTexture(GL_TEXTURE_3D, m_texture_id);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F, m_resolution, m_resolution, m_resolution, 0, GL_RGBA, GL_FLOAT, pixels.data());
+    glBindTexture(GL_TEXTURE_3D, 0);
+    
+    m_cl_obstacle_image = clCreateFromGLTexture(context, CL_MEM_READ_WRITE, GL_TEXTURE_3D, 0, m_texture_id, &cl_error);
+    CL_CHECK(cl_error);
+}
+
+void ObstacleField::create_kernels(cl_program program)
+{
+    cl_int cl_error;
+    
+    if (m_cl_krnl_bake_distance != NULL)
+        clReleaseKernel(m_cl_krnl_bake_distance);
+    
+    if (m_cl_krnl_bake_gradient != NULL)
+        clReleaseKernel(m_cl_krnl_bake_gradient);
+    
+    m_cl_krnl_bake_distance = clCreateKernel(program, "bake_obstacle_distance", &cl_error);
+    CL_CHECK(cl_error);
+    
+    m_cl_krnl_bake_gradient = clCreateKernel(program, "bake_obstacle_gradient", &cl_error);
+    CL_CHECK(cl_error);
+}
+
+bool ObstacleField::add_obj(const std::string &path, glm::mat4 transform)
+{
+    std::ifstream file(path);
+    
+    if (!file.is_open())
+        return false;
+    
+    size_t first_added = m_triangles.size();
+    
+    std::vector<glm::vec4> positions;
+    std::string line;
+    
+    while (std::getline(file, line)) {
+        
+        std::istringstream stream(line);
+        std::string type;
+        
+        stream >> type;
+        
+        if (type == "v") {
+            
+            glm::vec4 position(0.0f, 0.0f, 0.0f, 1.0f);
+            
+            stream >> position.x >> position.y >> position.z;
+            
+            positions.push_back(transform * position);
+        }
+        else if (type == "f") {
+            
+            // Faces may be polygons and corners may be v, v/vt, v//vn or v/vt/vn.
+            std::vector<int> face;
+            std::string corner;
+            
+            while (stream >> corner) {
+                
+                int index = std::atoi(corner.c_str());
+                
+                face.push_back(index < 0 ? (int)positions.size() + index : index - 1);
+            }
+            
+            for (size_t i = 2; i < face.size(); i++) {
+                
+                int triangle[] = {face[0], face[i - 1], face[i]};
+                
+                for (int index : triangle) {
+                    
+                    if (index < 0 || index >= (int)positions.size()) {
+                        printf("Obstacle %s has an invalid face index\n", path.c_str());
+                        m_triangles.resize(first_added);
+                        return false;
+                    }
+                }
+                
+                for (int index : triangle)
+                    m_triangles.insert(m_triangles.end(), {positions[index].x, positions[index].y, positions[index].z, 1.0f});
+            }
+            
+            if (get_triangle_count() > OBSTACLE_MAX_TRIANGLES) {
+                printf("Obstacle %s has more than %d triangles, too many to bake\n", path.c_str(), OBSTACLE_MAX_TRIANGLES);
+                m_triangles.resize(first_added);
+                return false;
+            }
+        }
+    }
+    
+    m_is_baked = false;
+    
+    return true;
+}
+
+void ObstacleField::add_sphere(glm::vec3 center, float radius, unsigned int slices, unsigned int stacks)
+{
+    auto corner = [&](unsigned int slice, unsigned int stack) {
+        
+        float theta = 2.0f * M_PI * slice / slices;
+        float phi = M_PI * stack / stacks;
+        
+        glm::vec3 position = center + radius * glm::vec3(std::sin(phi) * std::cos(theta), std::cos(phi), std::sin(phi) * std::sin(theta));
+        
+        m_triangles.insert(m_triangles.end(), {position.x, position.y, position.z, 1.0f});
+    };
+    
+    // Consistently wound so the winding number gives the inside.
+    for (unsigned int stack = 0; stack < stacks; stack++) {
+        for (unsigned int slice = 0; slice < slices; slice++) {
+            
+            corner(slice, stack);
+            corner(slice + 1, stack);
+            corner(slice + 1, stack + 1);
+            
+            corner(slice, stack);
+            corner(slice + 1, stack + 1);
+            corner(slice, stack + 1);
+        }
+    }
+    
+    m_is_baked = false;
+}
+
+void ObstacleField::clear()
+{
+    m_triangles.clear();
+    m_is_baked = false;
+}
+
+void ObstacleField::bake()
+{
+    cl_uint triangle_count = get_triangle_count();
+    
+    // Same mapping as the particle kernel, object space to 0..1 with z flipped.
+    std::vector<GLfloat> triangles(m_triangles);
+    
+    for (size_t i = 0; i < triangles.size(); i += 4) {
+        triangles[i] = triangles[i] * 0.5f + 0.5f;
+        triangles[i + 1] = triangles[i + 1] * 0.5f + 0.5f;
+        triangles[i + 2] = triangles[i + 2] * -0.5f + 0.5f;
+    }
+    
+    // OpenCL does not allow empty buffers.
+    if (triangles.empty())
+        triangles.resize(4 * 3, 0.0f);
+    
+    CLBuffer cl_triangles = OpenCLRuntime::get().acquire_buffer(CL_MEM_READ_ONLY, sizeof(GLfloat) * triangles.size());
+    
+    CL_CHECK( clEnqueueWriteBuffer(m_cl_cmd_queue, cl_triangles, CL_FALSE, 0, sizeof(GLfloat) * triangles.size(), triangles.data(), 0, NULL, NULL) );
+    
+    CLBuffer cl_distances = OpenCLRuntime::get().acquire_buffer(CL_MEM_READ_WRITE, sizeof(cl_float) * m_resolution * m_resolution * m_resolution);
+    
+    size_t global_work_size[] = {m_resolution, m_resolution, m_resolution};
+    
+    glFinish();
+    
+    CL_CHECK( clEnqueueAcquireGLObjects(m_cl_cmd_queue, 1, &m_cl_obstacle_image, NULL, NULL, NULL) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_bake_distance, 0, sizeof(cl_mem), cl_triangles.get_address()) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_bake_distance, 1, sizeof(cl_uint), &triangle_count) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_bake_distance, 2, sizeof(cl_mem), cl_distances.get_address()) );
+    
+    CL_CHECK( clEnqueueNDRangeKernel(m_cl_cmd_queue, m_cl_krnl_bake_distance, 3, NULL, global_work_size, NULL, 0, 0, 0) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_bake_gradient, 0, sizeof(cl_mem), cl_distances.get_address()) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_bake_gradient, 1, sizeof(m_cl_obstacle_image), &m_cl_obstacle_image) );
+    
+    CL_CHECK( clEnqueueNDRangeKernel(m_cl_cmd_queue, m_cl_krnl_bake_gradient, 3, NULL, global_work_size, NULL, 0, 0, 0) );
+    
+    CL_CHECK( clEnqueueReleaseGLObjects(m_cl_cmd_queue, 1, &m_cl_obstacle_image, NULL, NULL, NULL) );
+    
+    clFinish(m_cl_cmd_queue);
+    
+    m_is_baked = true;
+    
+    printf("Baked %u obstacle triangles into a %u^3 distance volume\n", triangle_count, m_resolution);
+}
+
+bool ObstacleField::is_baked()
+{
+    return m_is_baked;
+}
+
+unsigned int ObstacleField::get_triangle_count()
+{
+    return (unsigned int)(m_triangles.size() / 12);
+}
+
+GLuint ObstacleField::get_texture_id()
+{
+    return m_texture_id;
+}
+
+cl_mem ObstacleField::get_cl_image()
+{
+    return m_cl_obstacle_image;
+}
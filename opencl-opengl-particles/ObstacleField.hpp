@@ -0,0 +1,84 @@
+//
+//  ObstacleField.hpp
+//  opencl-opengl-particles
+//
+//  Bakes obstacle meshes into a signed distance volume aligned with the
+//  vector field bounding box. Each texel holds the distance gradient in rgb
+//  and the signed distance in a, so a collision test is a single fetch.
+//
+
+#ifndef ObstacleField_hpp
+#define ObstacleField_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include <OpenCL/OpenCL.h>
+#include <glm/glm.hpp>
+
+// The bake tests every texel against every triangle, so meshes are capped to keep it to a few seconds.
+#define OBSTACLE_MAX_TRIANGLES 4096
+
+// Must match the COLLISION_* defines in kerneltest.cl.
+enum CollisionMode
+{
+    COLLISION_NONE = 0,
+    COLLISION_BOUNCE = 1,
+    COLLISION_SLIDE = 2,
+    COLLISION_KILL = 3
+};
+
+class ObstacleField
+{
+private:
+    
+    unsigned int m_resolution;
+    
+    GLuint m_texture_id = 0;
+    
+    cl_command_queue m_cl_cmd_queue;
+    
+    cl_kernel m_cl_krnl_bake_distance = NULL;
+    cl_kernel m_cl_krnl_bake_gradient = NULL;
+    
+    cl_mem m_cl_obstacle_image;
+    
+    // Triangle corners in vector field object space, x y z 1.
+    std::vector<GLfloat> m_triangles;
+    
+    bool m_is_baked = false;
+    
+public:
+    
+    ObstacleField(unsigned int resolution)
+    {
+        m_resolution = resolution;
+    }
+    
+    ~ObstacleField();
+    
+    void initialize(cl_context context, cl_command_queue cmd_queue, cl_program program);
+    
+    // (Re)creates the kernels, used when the program is reloaded.
+    void create_kernels(cl_program program);
+    
+    // Meshes are given in vector field object space, the cube from -1 to 1.
+    // Returns false, adding nothing, if the file could not be read or has more than OBSTACLE_MAX_TRIANGLES.
+    bool add_obj(const std::string &path, glm::mat4 transform = glm::mat4(1.0f));
+    void add_sphere(glm::vec3 center, float radius, unsigned int slices = 24, unsigned int stacks = 12);
+    void clear();
+    
+    // Rebakes the volume from all added meshes, blocks until done.
+    // Costs resolution^3 x triangles point-triangle tests.
+    void bake();
+    
+    // False until baked, and again once the meshes change.
+    bool is_baked();
+    
+    unsigned int get_triangle_count();
+    GLuint get_texture_id();
+    cl_mem get_cl_image();
+};
+
+#endif /* ObstacleField_hpp */
@@ -0,0 +1,284 @@
+//
+//  OpenCLRuntime.cpp
+//  opencl-opengl-particles
+//
+//
+
+#include "OpenCLRuntime.hpp"
+#include "ProgramReloader.hpp"
+#include "Utility.hpp"
+
+#include <OpenGL/OpenGL.h>
+
+CLBuffer::CLBuffer(CLBuffer &&other)
+{
+    m_object = other.m_object;
+    m_flags = other.m_flags;
+    m_size = other.m_size;
+    
+    other.m_object = NULL;
+}
+
+CLBuffer &CLBuffer::operator=(CLBuffer &&other)
+{
+    if (this != &other) {
+        
+        reset();
+        
+        m_object = other.m_object;
+        m_flags = other.m_flags;
+        m_size = other.m_size;
+        
+        other.m_object = NULL;
+    }
+    
+    return *this;
+}
+
+CLBuffer::~CLBuffer()
+{
+    reset();
+}
+
+void CLBuffer::reset()
+{
+    if (m_object != NULL)
+        OpenCLRuntime::get().recycle_buffer(m_object, m_flags, m_size);
+    
+    m_object = NULL;
+}
+
+OpenCLRuntime::~OpenCLRuntime()
+{
+    this->release();
+}
+
+OpenCLRuntime &OpenCLRuntime::get()
+{
+    static OpenCLRuntime runtime;
+    
+    return runtime;
+}
+
+void OpenCLRuntime::initialize()
+{
+    if (m_cl_context != NULL)
+        return;
+    
+    cl_int cl_error;
+    
+    cl_platform_id cl_platform;
+    cl_uint number_of_platforms;
+    
+    // Get OpenCL platform.
+    cl_error = clGetPlatformIDs(1, &cl_platform, &number_of_platforms);
+    
+    CL_CHECK(cl_error);
+    
+    printf("Number of platforms: %u\n", number_of_platforms);
+    
+    // Get OpenCL version.
+    char info_string[1024];
+    
+    cl_error = clGetPlatformInfo(cl_platform, CL_PLATFORM_VERSION, sizeof(info_string), info_string, NULL);
+    
+    printf("OpenCL version: %s\n", info_string);
+    
+    // Set up OpenCL context.
+    
+    CGLContextObj kCGLContext = CGLGetCurrentContext();
+    CGLShareGroupObj kCGLShareGroup = CGLGetShareGroup(kCGLContext);
+    cl_context_properties props[] =
+    {
+        CL_CONTEXT_PROPERTY_USE_CGL_SHAREGROUP_APPLE, (cl_context_properties)kCGLShareGroup,
+        0
+    };
+    
+    m_cl_context = clCreateContext(props, 0, 0, NULL, NULL, &cl_error);
+    
+    printf("OpenCL context creation error: %u\n", cl_error);
+    
+    // Get GPU devices and info. Only devices in the share group can use the GL objects, so pick from the context's.
+    
+    cl_device_id devices[16];
+    size_t devices_size = 0;
+    
+    CL_CHECK( clGetContextInfo(m_cl_context, CL_CONTEXT_DEVICES, sizeof(devices), devices, &devices_size) );
+    
+    cl_uint number_of_devices = (cl_uint) (devices_size / sizeof(cl_device_id));
+    
+    printf("Number of devices: %u\n", number_of_devices);
+    
+    // Prefer a GPU, otherwise whatever else drives the share group.
+    m_cl_device = number_of_devices > 0 ? devices[0] : NULL;
+    
+    for (cl_uint i = 0;i < number_of_devices;i++) {
+        
+        cl_device_type device_type;
+        
+        CL_CHECK( clGetDeviceInfo(devices[i], CL_DEVICE_TYPE, sizeof(device_type), &device_type, NULL) );
+        
+        if (device_type & CL_DEVICE_TYPE_GPU) {
+            m_cl_device = devices[i];
+            break;
+        }
+    }
+    
+    cl_error = clGetDeviceInfo(m_cl_device, CL_DEVICE_NAME, sizeof(info_string), info_string, NULL);
+    
+    printf("Device name: %s\n", info_string);
+    
+    // Set up OpenCL command queue.
+    
+    m_cl_cmd_queue = clCreateCommandQueue(m_cl_context, m_cl_device, 0, &cl_error);
+    
+    printf("OpenCL command queue creation error: %u\n", cl_error);
+}
+
+void OpenCLRuntime::release()
+{
+    if (m_cl_context == NULL)
+        return;
+    
+    clFinish(m_cl_cmd_queue);
+    
+    m_vector_field_library.reset();
+    
+    for (auto &program : m_programs)
+        clReleaseProgram(program.second);
+    
+    for (auto &buffer : m_buffer_pool)
+        clReleaseMemObject(buffer.second);
+    
+    if (m_live_bytes > 0)
+        printf("OpenCL runtime released with %zu bytes of pooled buffers still in use\n", m_live_bytes);
+    
+    m_programs.clear();
+    m_buffer_pool.clear();
+    m_pooled_bytes = 0;
+    
+    clReleaseCommandQueue(m_cl_cmd_queue);
+    clReleaseContext(m_cl_context);
+    
+    m_cl_cmd_queue = NULL;
+    m_cl_context = NULL;
+    m_cl_device = NULL;
+}
+
+cl_device_id OpenCLRuntime::get_device()
+{
+    return m_cl_device;
+}
+
+cl_context OpenCLRuntime::get_context()
+{
+    return m_cl_context;
+}
+
+cl_command_queue OpenCLRuntime::get_command_queue()
+{
+    return m_cl_cmd_queue;
+}
+
+cl_program OpenCLRuntime::get_program(std::string path, std::string options, const std::vector<std::string> &kernel_names)
+{
+    std::pair<std::string, std::string> key(path, options);
+    
+    auto it = m_programs.find(key);
+    
+    // A cached program may have been built for a caller that needed fewer kernels.
+    if (it != m_programs.end() && !ProgramReloader::has_kernels(it->second, path, kernel_names)) {
+        clReleaseProgram(it->second);
+        m_programs.erase(it);
+        it = m_programs.end();
+    }
+    
+    if (it == m_programs.end()) {
+        
+        cl_program program = ProgramReloader::build_program(m_cl_context, m_cl_device, path, options, kernel_names);
+        
+        if (program == NULL)
+            return NULL;
+        
+        it = m_programs.insert(std::make_pair(key, program)).first;
+    }
+    
+    clRetainProgram(it->second);
+    
+    return it->second;
+}
+
+void OpenCLRuntime::set_program(std::string path, std::string options, cl_program program)
+{
+    std::pair<std::string, std::string> key(path, options);
+    
+    clRetainProgram(program);
+    
+    auto it = m_programs.find(key);
+    
+    if (it != m_programs.end()) {
+        clReleaseProgram(it->second);
+        it->second = program;
+    }
+    else {
+        m_programs.insert(std::make_pair(key, program));
+    }
+}
+
+std::shared_ptr<VectorFieldLibrary> OpenCLRuntime::get_vector_field_library(const std::vector<std::string> &paths, size_t memory_budget)
+{
+    if (m_vector_field_library == NULL || m_vector_field_library->get_paths() != paths) {
+        m_vector_field_library = std::make_shared<VectorFieldLibrary>(paths, memory_budget);
+        m_vector_field_library->initialize(m_cl_context);
+    }
+    
+    return m_vector_field_library;
+}
+
+CLBuffer OpenCLRuntime::acquire_buffer(cl_mem_flags flags, size_t size)
+{
+    auto it = m_buffer_pool.find(std::make_pair(flags, size));
+    
+    cl_mem buffer;
+    
+    if (it != m_buffer_pool.end()) {
+        
+        buffer = it->second;
+        
+        m_buffer_pool.erase(it);
+        m_pooled_bytes -= size;
+    }
+    else {
+        
+        cl_int cl_error;
+        
+        buffer = clCreateBuffer(m_cl_context, flags, size, NULL, &cl_error);
+        CL_CHECK(cl_error);
+        
+        if (buffer == NULL)
+            return CLBuffer();
+    }
+    
+    m_live_bytes += size;
+    
+    return CLBuffer(buffer, flags, size);
+}
+
+void OpenCLRuntime::recycle_buffer(cl_mem buffer, cl_mem_flags flags, size_t size)
+{
+    m_live_bytes -= size;
+    
+    // Past the budget the buffer is freed rather than kept, so the pool stays bounded.
+    if (m_cl_context == NULL || m_pooled_bytes + size > m_pool_budget) {
+        clReleaseMemObject(buffer);
+        return;
+    }
+    
+    m_buffer_pool.insert(std::make_pair(std::make_pair(flags, size), buffer));
+    m_pooled_bytes += size;
+}
+
+void OpenCLRuntime::print_statistics()
+{
+    printf("OpenCL runtime: %zu programs, %zu bytes of buffers in use, %zu bytes pooled in %zu buffers\n", m_programs.size(), m_live_bytes, m_pooled_bytes, m_buffer_pool.size());
+}
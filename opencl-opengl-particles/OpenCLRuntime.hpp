@@ -0,0 +1,190 @@
+//
+//  OpenCLRuntime.hpp
+//  opencl-opengl-particles
+//
+//  Process-wide OpenCL runtime shared by every scene. It owns the context,
+//  command queue and built programs, and pools plain device buffers, so a
+//  scene switch reuses everything warm instead of creating it all again.
+//  The vector field library lives here too, so resident fields survive.
+//  Scenes hold their objects through the RAII handles below.
+//
+
+#ifndef OpenCLRuntime_hpp
+#define OpenCLRuntime_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <OpenCL/OpenCL.h>
+
+#include "VectorFieldLibrary.hpp"
+
+inline void release_cl_object(cl_mem object) { clReleaseMemObject(object); }
+inline void release_cl_object(cl_kernel object) { clReleaseKernel(object); }
+inline void release_cl_object(cl_program object) { clReleaseProgram(object); }
+inline void release_cl_object(cl_event object) { clReleaseEvent(object); }
+
+// Owns one reference to an OpenCL object and releases it when reset or destroyed.
+template<typename T>
+class CLHandle
+{
+private:
+    
+    T m_object = NULL;
+    
+public:
+    
+    CLHandle() {}
+    
+    explicit CLHandle(T object)
+    {
+        m_object = object;
+    }
+    
+    CLHandle(CLHandle &&other)
+    {
+        m_object = other.m_object;
+        other.m_object = NULL;
+    }
+    
+    CLHandle &operator=(CLHandle &&other)
+    {
+        if (this != &other) {
+            reset(other.m_object);
+            other.m_object = NULL;
+        }
+        
+        return *this;
+    }
+    
+    CLHandle(const CLHandle &) = delete;
+    CLHandle &operator=(const CLHandle &) = delete;
+    
+    ~CLHandle()
+    {
+        reset();
+    }
+    
+    // Takes ownership of object, releasing the current one.
+    void reset(T object = NULL)
+    {
+        if (m_object != NULL)
+            release_cl_object(m_object);
+        
+        m_object = object;
+    }
+    
+    operator T() const
+    {
+        return m_object;
+    }
+    
+    // For clSetKernelArg.
+    const T *get_address() const
+    {
+        return &m_object;
+    }
+};
+
+// A device buffer from the runtime's pool, handed back to it when reset or destroyed.
+class CLBuffer
+{
+private:
+    
+    cl_mem m_object = NULL;
+    cl_mem_flags m_flags = 0;
+    size_t m_size = 0;
+    
+public:
+    
+    CLBuffer() {}
+    
+    CLBuffer(cl_mem object, cl_mem_flags flags, size_t size)
+    {
+        m_object = object;
+        m_flags = flags;
+        m_size = size;
+    }
+    
+    CLBuffer(CLBuffer &&other);
+    CLBuffer &operator=(CLBuffer &&other);
+    
+    CLBuffer(const CLBuffer &) = delete;
+    CLBuffer &operator=(const CLBuffer &) = delete;
+    
+    ~CLBuffer();
+    
+    void reset();
+    
+    operator cl_mem() const
+    {
+        return m_object;
+    }
+    
+    // For clSetKernelArg.
+    const cl_mem *get_address() const
+    {
+        return &m_object;
+    }
+    
+    size_t get_size() const
+    {
+        return m_size;
+    }
+};
+
+class OpenCLRuntime
+{
+private:
+    
+    cl_device_id m_cl_device = NULL;
+    cl_context m_cl_context = NULL;
+    cl_command_queue m_cl_cmd_queue = NULL;
+    
+    // Keyed by source path and build options.
+    std::map<std::pair<std::string, std::string>, cl_program> m_programs;
+    
+    // Free buffers keyed by flags and size, only exact matches are reused.
+    std::multimap<std::pair<cl_mem_flags, size_t>, cl_mem> m_buffer_pool;
+    size_t m_pool_budget = 64 * 1024 * 1024;
+    size_t m_pooled_bytes = 0;
+    size_t m_live_bytes = 0;
+    
+    std::shared_ptr<VectorFieldLibrary> m_vector_field_library;
+    
+    OpenCLRuntime() {}
+    
+public:
+    
+    ~OpenCLRuntime();
+    
+    static OpenCLRuntime &get();
+    
+    // Creates the context on the current OpenGL share group, once per process.
+    void initialize();
+    
+    // Releases everything, call while the OpenGL context is still alive.
+    void release();
+    
+    cl_device_id get_device();
+    cl_context get_context();
+    cl_command_queue get_command_queue();
+    
+    // Returns a new reference to the program, building it on first use. NULL if the build failed.
+    cl_program get_program(std::string path, std::string options, const std::vector<std::string> &kernel_names);
+    
+    // Replaces the cached program after a hot reload, the cache takes its own reference.
+    void set_program(std::string path, std::string options, cl_program program);
+    
+    // Returns the shared library, creating it on first use or when the set of fields changes.
+    std::shared_ptr<VectorFieldLibrary> get_vector_field_library(const std::vector<std::string> &paths, size_t memory_budget);
+    
+    CLBuffer acquire_buffer(cl_mem_flags flags, size_t size);
+    void recycle_buffer(cl_mem buffer, cl_mem_flags flags, size_t size);
+    
+    void print_statistics();
+};
+
+#endif /* OpenCLRuntime_hpp */
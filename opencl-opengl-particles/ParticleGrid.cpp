@@ -0,0 +1,125 @@
+//
+//  ParticleGrid.cpp
+//  opencl-opengl-particles
+//
+//
+
+#include "ParticleGrid.hpp"
+#include "Utility.hpp"
+
+#include <vector>
+
+ParticleGrid::~ParticleGrid()
+{
+    if (m_texture_id == 0)
+        return;
+    
+    clFinish(m_cl_cmd_queue);
+    
+    clReleaseMemObject(m_cl_grid_image);
+    clReleaseKernel(m_cl_krnl_resolve);
+    clReleaseKernel(m_cl_krnl_splat);
+    
+    glDeleteTextures(1, &m_texture_id);
+}
+
+void ParticleGrid::initialize(cl_context context, cl_command_queue cmd_queue, cl_program program)
+{
+    cl_int cl_error;
+    
+    m_cl_cmd_queue = cmd_queue;
+    
+    create_kernels(program);
+    
+    size_t number_of_cells = m_resolution * m_resolution * m_resolution;
+    
+    // Scratch only, cleared before every splat, so pooled buffers can be reused as they are.
+    m_cl_grid_density = OpenCLRuntime::get().acquire_buffer(CL_MEM_READ_WRITE, sizeof(cl_uint) * number_of_cells);
+    m_cl_grid_velocity = OpenCLRuntime::get().acquire_buffer(CL_MEM_READ_WRITE, sizeof(cl_int) * 3 * number_of_cells);
+    
+    // Start empty so the coupling term is zero until the first splat.
+    std::vector<GLfloat> pixels(number_of_cells * 4, 0.0f);
+    
+    glGenTextures(1, &m_texture_id);
+    glBindTexture(GL_TEXTURE_3D, m_texture_id);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F, m_resolution, m_resolution, m_resolution, 0, GL_RGBA, GL_FLOAT, pixels.data());
+    glBindTexture(GL_TEXTURE_3D, 0);
+    
+    m_cl_grid_image = clCreateFromGLTexture(context, CL_MEM_READ_WRITE, GL_TEXTURE_3D, 0, m_texture_id, &cl_error);
+    CL_CHECK(cl_error);
+}
+
+void ParticleGrid::create_kernels(cl_program program)
+{
+    cl_int cl_error;
+    
+    if (m_cl_krnl_splat != NULL)
+        clReleaseKernel(m_cl_krnl_splat);
+    
+    if (m_cl_krnl_resolve != NULL)
+        clReleaseKernel(m_cl_krnl_resolve);
+    
+    m_cl_krnl_splat = clCreateKernel(program, "splat_particle_grid", &cl_error);
+    CL_CHECK(cl_error);
+    
+    m_cl_krnl_resolve = clCreateKernel(program, "resolve_particle_grid", &cl_error);
+    CL_CHECK(cl_error);
+}
+
+void ParticleGrid::splat(cl_mem particle_buffer, cl_mem bounding_box, unsigned int particle_count)
+{
+    cl_uint zero = 0;
+    size_t number_of_cells = m_resolution * m_resolution * m_resolution;
+    
+    CL_CHECK( clEnqueueFillBuffer(m_cl_cmd_queue, m_cl_grid_density, &zero, sizeof(zero), 0, sizeof(cl_uint) * number_of_cells, 0, NULL, NULL) );
+    CL_CHECK( clEnqueueFillBuffer(m_cl_cmd_queue, m_cl_grid_velocity, &zero, sizeof(zero), 0, sizeof(cl_int) * 3 * number_of_cells, 0, NULL, NULL) );
+    
+    size_t splat_global_work_size[] = {(particle_count + PARTICLE_GRID_GROUP_SIZE - 1) / PARTICLE_GRID_GROUP_SIZE * PARTICLE_GRID_GROUP_SIZE};
+    size_t splat_local_work_size[] = {PARTICLE_GRID_GROUP_SIZE};
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_splat, 0, sizeof(particle_buffer), &particle_buffer) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_splat, 1, sizeof(bounding_box), &bounding_box) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_splat, 2, sizeof(cl_uint), &particle_count) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_splat, 3, sizeof(cl_uint), &m_resolution) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_splat, 4, sizeof(cl_mem), m_cl_grid_density.get_address()) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_splat, 5, sizeof(cl_mem), m_cl_grid_velocity.get_address()) );
+    
+    CL_CHECK( clEnqueueNDRangeKernel(m_cl_cmd_queue, m_cl_krnl_splat, 1, NULL, splat_global_work_size, splat_local_work_size, 0, 0, 0) );
+    
+    size_t resolve_global_work_size[] = {m_resolution, m_resolution, m_resolution};
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_resolve, 0, sizeof(cl_mem), m_cl_grid_density.get_address()) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_resolve, 1, sizeof(cl_mem), m_cl_grid_velocity.get_address()) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_resolve, 2, sizeof(cl_uint), &particle_count) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_resolve, 3, sizeof(m_cl_grid_image), &m_cl_grid_image) );
+    
+    CL_CHECK( clEnqueueNDRangeKernel(m_cl_cmd_queue, m_cl_krnl_resolve, 3, NULL, resolve_global_work_size, NULL, 0, 0, 0) );
+}
+
+unsigned int ParticleGrid::get_resolution()
+{
+    return m_resolution;
+}
+
+GLuint ParticleGrid::get_texture_id()
+{
+    return m_texture_id;
+}
+
+cl_mem ParticleGrid::get_cl_image()
+{
+    return m_cl_grid_image;
+}
@@ -0,0 +1,62 @@
+//
+//  ParticleGrid.hpp
+//  opencl-opengl-particles
+//
+//  Splats particles into a density and velocity grid aligned with the
+//  vector field bounding box. The grid lives in a 3D texture shared with
+//  OpenCL, for volume rendering and for coupling back into the simulation.
+//
+
+#ifndef ParticleGrid_hpp
+#define ParticleGrid_hpp
+
+#include <stdio.h>
+#include <GL/glew.h>
+#include <OpenCL/OpenCL.h>
+
+#include "OpenCLRuntime.hpp"
+
+// Must match GRID_CACHE_SIZE in kerneltest.cl.
+#define PARTICLE_GRID_GROUP_SIZE 256
+
+class ParticleGrid
+{
+private:
+    
+    unsigned int m_resolution;
+    
+    GLuint m_texture_id = 0;
+    
+    cl_command_queue m_cl_cmd_queue;
+    
+    cl_kernel m_cl_krnl_splat = NULL;
+    cl_kernel m_cl_krnl_resolve = NULL;
+    
+    CLBuffer m_cl_grid_density;
+    CLBuffer m_cl_grid_velocity;
+    cl_mem m_cl_grid_image;
+    
+public:
+    
+    ParticleGrid(unsigned int resolution)
+    {
+        m_resolution = resolution;
+    }
+    
+    ~ParticleGrid();
+    
+    void initialize(cl_context context, cl_command_queue cmd_queue, cl_program program);
+    
+    // (Re)creates the kernels, used when the program is reloaded.
+    void create_kernels(cl_program program);
+    
+    // Splats the particles and resolves the grid image. The particle buffer and
+    // the grid image must already be acquired from OpenGL.
+    void splat(cl_mem particle_buffer, cl_mem bounding_box, unsigned int particle_count);
+    
+    unsigned int get_resolution();
+    GLuint get_texture_id();
+    cl_mem get_cl_image();
+};
+
+#endif /* ParticleGrid_hpp */
@@ -0,0 +1,166 @@
+//
+//  ParticleStatistics.cpp
+//  opencl-opengl-particles
+//
+//
+
+#include "ParticleStatistics.hpp"
+#include "Utility.hpp"
+
+#include <string.h>
+
+ParticleStatisticsReducer::~ParticleStatisticsReducer()
+{
+    if (m_readback_slots.empty())
+        return;
+    
+    clFinish(m_cl_cmd_queue);
+    
+    for (ReadbackSlot &slot : m_readback_slots) {
+        
+        if (slot.cl_read_event != NULL)
+            clReleaseEvent(slot.cl_read_event);
+        
+        clEnqueueUnmapMemObject(m_cl_cmd_queue, slot.cl_host_buffer, slot.host_data, 0, NULL, NULL);
+    }
+    
+    // The pooled buffers go back to the runtime once unmapped.
+    clFinish(m_cl_cmd_queue);
+    
+    clReleaseKernel(m_cl_krnl_reduce);
+    clReleaseKernel(m_cl_krnl_finalize);
+}
+
+void ParticleStatisticsReducer::initialize(cl_command_queue cmd_queue, cl_program program)
+{
+    cl_int cl_error;
+    
+    m_cl_cmd_queue = cmd_queue;
+    
+    create_kernels(program);
+    
+    m_cl_statistics = OpenCLRuntime::get().acquire_buffer(CL_MEM_READ_WRITE, sizeof(ParticleStatistics));
+    
+    // Pinned host buffers, mapped once for the lifetime of the reducer.
+    m_readback_slots.resize(STATISTICS_RING_SIZE);
+    
+    for (unsigned int i = 0;i < STATISTICS_RING_SIZE;i++) {
+        ReadbackSlot &slot = m_readback_slots[i];
+        
+        slot.cl_host_buffer = OpenCLRuntime::get().acquire_buffer(CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sizeof(ParticleStatistics));
+        
+        slot.host_data = (ParticleStatistics *) clEnqueueMapBuffer(cmd_queue, slot.cl_host_buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, sizeof(ParticleStatistics), 0, NULL, NULL, &cl_error);
+        CL_CHECK(cl_error);
+        
+        slot.cl_read_event = NULL;
+        
+        m_free_slots.push_back(i);
+    }
+}
+
+void ParticleStatisticsReducer::create_kernels(cl_program program)
+{
+    cl_int cl_error;
+    
+    if (m_cl_krnl_reduce != NULL)
+        clReleaseKernel(m_cl_krnl_reduce);
+    
+    if (m_cl_krnl_finalize != NULL)
+        clReleaseKernel(m_cl_krnl_finalize);
+    
+    m_cl_krnl_reduce = clCreateKernel(program, "reduce_particle_statistics", &cl_error);
+    CL_CHECK(cl_error);
+    
+    m_cl_krnl_finalize = clCreateKernel(program, "finalize_particle_statistics", &cl_error);
+    CL_CHECK(cl_error);
+}
+
+void ParticleStatisticsReducer::reduce(cl_mem particle_buffer, cl_mem bounding_box, unsigned int particle_count, float histogram_max_speed)
+{
+    if (m_free_slots.empty() || particle_count == 0)
+        return;
+    
+    size_t number_of_partials = (particle_count + STATISTICS_GROUP_SIZE - 1) / STATISTICS_GROUP_SIZE;
+    
+    if (number_of_partials > m_number_of_partials) {
+        
+        // Partials are 8 floats or uints per work group.
+        m_cl_partials = OpenCLRuntime::get().acquire_buffer(CL_MEM_READ_WRITE, number_of_partials * 8 * sizeof(float));
+        
+        m_number_of_partials = number_of_partials;
+    }
+    
+    cl_uint zero = 0;
+    
+    CL_CHECK( clEnqueueFillBuffer(m_cl_cmd_queue, m_cl_statistics, &zero, sizeof(zero), 0, sizeof(ParticleStatistics), 0, NULL, NULL) );
+    
+    size_t reduce_global_work_size[] = {number_of_partials * STATISTICS_GROUP_SIZE};
+    size_t local_work_size[] = {STATISTICS_GROUP_SIZE};
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_reduce, 0, sizeof(particle_buffer), &particle_buffer) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_reduce, 1, sizeof(bounding_box), &bounding_box) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_reduce, 2, sizeof(cl_uint), &particle_count) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_reduce, 3, sizeof(float), &histogram_max_speed) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_reduce, 4, sizeof(cl_mem), m_cl_partials.get_address()) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_reduce, 5, sizeof(cl_mem), m_cl_statistics.get_address()) );
+    
+    CL_CHECK( clEnqueueNDRangeKernel(m_cl_cmd_queue, m_cl_krnl_reduce, 1, NULL, reduce_global_work_size, local_work_size, 0, 0, 0) );
+    
+    cl_uint number_of_partials_arg = (cl_uint) number_of_partials;
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_finalize, 0, sizeof(cl_mem), m_cl_partials.get_address()) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_finalize, 1, sizeof(cl_uint), &number_of_partials_arg) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_finalize, 2, sizeof(cl_mem), m_cl_statistics.get_address()) );
+    
+    CL_CHECK( clEnqueueNDRangeKernel(m_cl_cmd_queue, m_cl_krnl_finalize, 1, NULL, local_work_size, local_work_size, 0, 0, 0) );
+    
+    m_reduced_slot = m_free_slots.front();
+    m_free_slots.pop_front();
+}
+
+void ParticleStatisticsReducer::submit_readback()
+{
+    if (m_reduced_slot < 0)
+        return;
+    
+    ReadbackSlot &slot = m_readback_slots[m_reduced_slot];
+    
+    CL_CHECK( clEnqueueReadBuffer(m_cl_cmd_queue, m_cl_statistics, CL_FALSE, 0, sizeof(ParticleStatistics), slot.host_data, 0, NULL, &slot.cl_read_event) );
+    
+    clFlush(m_cl_cmd_queue);
+    
+    m_pending_slots.push_back(m_reduced_slot);
+    m_reduced_slot = -1;
+}
+
+bool ParticleStatisticsReducer::poll(ParticleStatistics &statistics)
+{
+    if (m_pending_slots.empty())
+        return false;
+    
+    ReadbackSlot &slot = m_readback_slots[m_pending_slots.front()];
+    
+    cl_int status;
+    
+    CL_CHECK( clGetEventInfo(slot.cl_read_event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL) );
+    
+    if (status != CL_COMPLETE)
+        return false;
+    
+    memcpy(&statistics, slot.host_data, sizeof(ParticleStatistics));
+    
+    clReleaseEvent(slot.cl_read_event);
+    slot.cl_read_event = NULL;
+    
+    m_free_slots.push_back(m_pending_slots.front());
+    m_pending_slots.pop_front();
+    
+    return true;
+}
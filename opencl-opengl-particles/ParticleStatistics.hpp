@@ -0,0 +1,88 @@
+//
+//  ParticleStatistics.hpp
+//  opencl-opengl-particles
+//
+//  Reduces the particle buffer on the device into a small statistics
+//  block, which is read back without blocking the frame loop.
+//
+
+#ifndef ParticleStatistics_hpp
+#define ParticleStatistics_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <OpenCL/OpenCL.h>
+
+#include "OpenCLRuntime.hpp"
+
+// Must match the definitions in kerneltest.cl.
+#define STATISTICS_GROUP_SIZE 256
+#define STATISTICS_HISTOGRAM_BINS 32
+
+// Number of pinned readback buffers in flight.
+#define STATISTICS_RING_SIZE 3
+
+struct ParticleStatistics
+{
+    float speed_min;
+    float speed_max;
+    float speed_mean;
+    float life_ratio_min;
+    float life_ratio_max;
+    float life_ratio_mean;
+    uint32_t inside_count;
+    uint32_t outside_count;
+    uint32_t speed_histogram[STATISTICS_HISTOGRAM_BINS];
+    uint32_t life_ratio_histogram[STATISTICS_HISTOGRAM_BINS];
+};
+
+class ParticleStatisticsReducer
+{
+private:
+    
+    struct ReadbackSlot
+    {
+        CLBuffer cl_host_buffer;
+        ParticleStatistics *host_data;
+        cl_event cl_read_event;
+    };
+    
+    cl_command_queue m_cl_cmd_queue;
+    
+    cl_kernel m_cl_krnl_reduce = NULL;
+    cl_kernel m_cl_krnl_finalize = NULL;
+    
+    CLBuffer m_cl_partials;
+    CLBuffer m_cl_statistics;
+    
+    size_t m_number_of_partials = 0;
+    
+    std::vector<ReadbackSlot> m_readback_slots;
+    std::deque<unsigned int> m_free_slots;
+    std::deque<unsigned int> m_pending_slots;
+    
+    int m_reduced_slot = -1;
+    
+public:
+    
+    ~ParticleStatisticsReducer();
+    
+    void initialize(cl_command_queue cmd_queue, cl_program program);
+    
+    // (Re)creates the kernels, used when the program is reloaded.
+    void create_kernels(cl_program program);
+    
+    // Reduces the particle buffer, which must already be acquired from OpenGL.
+    // Skipped when every readback buffer is still in flight.
+    void reduce(cl_mem particle_buffer, cl_mem bounding_box, unsigned int particle_count, float histogram_max_speed);
+    
+    // Queues the non-blocking readback of the last reduction.
+    void submit_readback();
+    
+    // Returns true and fills statistics when the oldest readback has completed.
+    bool poll(ParticleStatistics &statistics);
+};
+
+#endif /* ParticleStatistics_hpp */
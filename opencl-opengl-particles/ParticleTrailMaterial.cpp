@@ -0,0 +1,26 @@
+//
+//  ParticleTrailMaterial.cpp
+//  opencl-opengl-particles
+//
+//
+
+#include "ParticleTrailMaterial.hpp"
+
+void ParticleTrailMaterial::set_trail_head(unsigned int trail_length, unsigned int trail_head)
+{
+    m_trail_length = trail_length;
+    m_trail_head = trail_head;
+}
+
+void ParticleTrailMaterial::apply(std::shared_ptr<Object> object, std::shared_ptr<Camera> camera)
+{
+    Material::apply(object, camera);
+    
+    m_shader->set_uniform("trail_length", (int) m_trail_length);
+    m_shader->set_uniform("trail_head", (int) m_trail_head);
+    
+    // Same additive blending as the point sprites.
+    glEnable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+}
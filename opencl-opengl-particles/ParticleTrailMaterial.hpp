@@ -0,0 +1,33 @@
+//
+//  ParticleTrailMaterial.hpp
+//  opencl-opengl-particles
+//
+//
+
+#ifndef ParticleTrailMaterial_hpp
+#define ParticleTrailMaterial_hpp
+
+#include <stdio.h>
+
+#include "Material.hpp"
+
+class ParticleTrailMaterial : public Material
+{
+private:
+    
+    unsigned int m_trail_length = 1;
+    unsigned int m_trail_head = 0;
+    
+public:
+    
+    ParticleTrailMaterial(std::shared_ptr<Shader> shader) : Material(shader)
+    {
+    }
+    
+    // The ring slot written last, segments fade out with their age from it.
+    void set_trail_head(unsigned int trail_length, unsigned int trail_head);
+    
+    void apply(std::shared_ptr<Object> object, std::shared_ptr<Camera> camera);
+};
+
+#endif /* ParticleTrailMaterial_hpp */
@@ -0,0 +1,97 @@
+//
+//  ParticleTrails.cpp
+//  opencl-opengl-particles
+//
+//
+
+#include "ParticleTrails.hpp"
+#include "Utility.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// Two float4 vertices per segment, written by particle_simulation.
+static const size_t BYTES_PER_SEGMENT = sizeof(GLfloat) * 4 * 2;
+
+ParticleTrails::~ParticleTrails()
+{
+    if (m_cl_trail_buffer != NULL)
+        clReleaseMemObject(m_cl_trail_buffer);
+}
+
+void ParticleTrails::initialize(std::shared_ptr<Material> material)
+{
+    m_mesh = std::make_shared<Mesh>();
+    m_mesh->set_material(material);
+    m_mesh->set_rendering_mode(GL_LINES);
+}
+
+void ParticleTrails::resize(cl_context context, unsigned int particle_count)
+{
+    if (m_cl_trail_buffer != NULL) {
+        clReleaseMemObject(m_cl_trail_buffer);
+        m_cl_trail_buffer = NULL;
+    }
+    
+    size_t sampled_count = (particle_count + m_sample_stride - 1) / m_sample_stride;
+    size_t budget_count = m_memory_budget / (BYTES_PER_SEGMENT * m_trail_length);
+    
+    m_trail_count = (unsigned int) std::min(sampled_count, budget_count);
+    
+    // Zeroed segments have w = 0 and are not drawn until written.
+    std::vector<GLfloat> vertices(get_memory_footprint() / sizeof(GLfloat), 0.0f);
+    std::vector<unsigned int> trail_attributes = {4};
+    
+    m_mesh->initialize(vertices, trail_attributes);
+    
+    if (m_trail_count == 0)
+        return;
+    
+    cl_int cl_error;
+    
+    m_cl_trail_buffer = clCreateFromGLBuffer(context, CL_MEM_WRITE_ONLY, m_mesh->get_vertex_buffer_object(), &cl_error);
+    CL_CHECK(cl_error);
+    
+    if (m_trail_count < sampled_count)
+        printf("Trail memory budget reached, tracing %u of %zu sampled particles\n", m_trail_count, sampled_count);
+}
+
+void ParticleTrails::set_trail_length(unsigned int trail_length)
+{
+    m_trail_length = std::max(trail_length, 2u);
+}
+
+void ParticleTrails::set_sample_stride(unsigned int sample_stride)
+{
+    m_sample_stride = std::max(sample_stride, 1u);
+}
+
+unsigned int ParticleTrails::get_trail_count()
+{
+    return m_trail_count;
+}
+
+unsigned int ParticleTrails::get_trail_length()
+{
+    return m_trail_length;
+}
+
+unsigned int ParticleTrails::get_sample_stride()
+{
+    return m_sample_stride;
+}
+
+size_t ParticleTrails::get_memory_footprint()
+{
+    return (size_t) m_trail_count * m_trail_length * BYTES_PER_SEGMENT;
+}
+
+std::shared_ptr<Mesh> ParticleTrails::get_mesh()
+{
+    return m_mesh;
+}
+
+cl_mem ParticleTrails::get_cl_buffer()
+{
+    return m_cl_trail_buffer;
+}
@@ -0,0 +1,65 @@
+//
+//  ParticleTrails.hpp
+//  opencl-opengl-particles
+//
+//  Ring buffer of the last few movement segments of a sampled subset of
+//  particles. The buffer is a GL vertex buffer shared with OpenCL, written
+//  by the simulation kernel and drawn directly as lines.
+//
+
+#ifndef ParticleTrails_hpp
+#define ParticleTrails_hpp
+
+#include <stdio.h>
+#include <GL/glew.h>
+#include <OpenCL/OpenCL.h>
+
+#include "Mesh.hpp"
+
+class ParticleTrails
+{
+private:
+    
+    unsigned int m_trail_length;
+    unsigned int m_sample_stride;
+    size_t m_memory_budget;
+    
+    unsigned int m_trail_count = 0;
+    
+    std::shared_ptr<Mesh> m_mesh;
+    
+    cl_mem m_cl_trail_buffer = NULL;
+    
+public:
+    
+    ParticleTrails(unsigned int trail_length, unsigned int sample_stride, size_t memory_budget)
+    {
+        m_trail_length = trail_length;
+        m_sample_stride = sample_stride;
+        m_memory_budget = memory_budget;
+    }
+    
+    ~ParticleTrails();
+    
+    void initialize(std::shared_ptr<Material> material);
+    
+    // Sizes and clears the ring for a particle count, clamped to the memory
+    // budget. A count of zero frees it.
+    void resize(cl_context context, unsigned int particle_count);
+    
+    // Take effect on the next resize.
+    void set_trail_length(unsigned int trail_length);
+    void set_sample_stride(unsigned int sample_stride);
+    
+    unsigned int get_trail_count();
+    unsigned int get_trail_length();
+    unsigned int get_sample_stride();
+    size_t get_memory_footprint();
+    
+    std::shared_ptr<Mesh> get_mesh();
+    
+    // NULL while freed.
+    cl_mem get_cl_buffer();
+};
+
+#endif /* ParticleTrails_hpp */
@@ -0,0 +1,26 @@
+//
+//  ParticleVolumeMaterial.cpp
+//  opencl-opengl-particles
+//
+//
+
+#include "ParticleVolumeMaterial.hpp"
+
+void ParticleVolumeMaterial::set_density_scale(float density_scale)
+{
+    m_density_scale = density_scale;
+}
+
+void ParticleVolumeMaterial::apply(std::shared_ptr<Object> object, std::shared_ptr<Camera> camera)
+{
+    Material::apply(object, camera);
+    
+    glBindTexture(GL_TEXTURE_3D, m_grid_texture_id);
+    
+    m_shader->set_uniform("density_scale", m_density_scale);
+    
+    // Same additive blending as the point sprites.
+    glEnable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+}
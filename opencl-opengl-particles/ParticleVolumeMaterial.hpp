@@ -0,0 +1,35 @@
+//
+//  ParticleVolumeMaterial.hpp
+//  opencl-opengl-particles
+//
+//
+
+#ifndef ParticleVolumeMaterial_hpp
+#define ParticleVolumeMaterial_hpp
+
+#include <stdio.h>
+
+#include "Material.hpp"
+
+class ParticleVolumeMaterial : public Material
+{
+private:
+    
+    GLuint m_grid_texture_id;
+    
+    float m_density_scale;
+    
+public:
+    
+    ParticleVolumeMaterial(std::shared_ptr<Shader> shader, GLuint grid_texture_id) : Material(shader)
+    {
+        m_grid_texture_id = grid_texture_id;
+        m_density_scale = 1.0f;
+    }
+    
+    void set_density_scale(float density_scale);
+    
+    void apply(std::shared_ptr<Object> object, std::shared_ptr<Camera> camera);
+};
+
+#endif /* ParticleVolumeMaterial_hpp */
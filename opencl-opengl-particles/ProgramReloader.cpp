@@ -0,0 +1,200 @@
+//
+//  ProgramReloader.cpp
+//  opencl-opengl-particles
+//
+//
+
+#include "ProgramReloader.hpp"
+#include "Utility.hpp"
+
+#include <sstream>
+#include <algorithm>
+
+ProgramReloader::~ProgramReloader()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_build_mutex);
+        
+        m_is_stopping = true;
+    }
+    
+    m_build_condition.notify_one();
+    
+    if (m_build_thread.joinable())
+        m_build_thread.join();
+    
+    if (m_cl_built_program != NULL)
+        clReleaseProgram(m_cl_built_program);
+}
+
+cl_program ProgramReloader::build_program(cl_context context, cl_device_id device, std::string path, std::string options, const std::vector<std::string> &kernel_names)
+{
+    cl_int cl_error;
+    
+    std::string program_source = utility::load_file(path);
+    const char* program_source_char = program_source.c_str();
+    size_t program_length = program_source.size();
+    
+    cl_program program = clCreateProgramWithSource(context, 1, &program_source_char, &program_length, &cl_error);
+    
+    if (cl_error != CL_SUCCESS) {
+        printf("OpenCL program creation error: %d\n", cl_error);
+        return NULL;
+    }
+    
+    cl_error = clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL);
+    
+    if (cl_error != CL_SUCCESS) {
+        
+        size_t log_size;
+        
+        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+        
+        std::vector<char> build_log(log_size + 1, '\0');
+        
+        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size, build_log.data(), NULL);
+        
+        printf("OpenCL program %s failed to build:\n%s\n", path.c_str(), build_log.data());
+        
+        clReleaseProgram(program);
+        return NULL;
+    }
+    
+    // A program missing a kernel would leave the scene half swapped.
+    if (!has_kernels(program, path, kernel_names)) {
+        clReleaseProgram(program);
+        return NULL;
+    }
+    
+    return program;
+}
+
+bool ProgramReloader::has_kernels(cl_program program, std::string path, const std::vector<std::string> &kernel_names)
+{
+    for (const std::string &kernel_name : kernel_names) {
+        
+        cl_int cl_error;
+        
+        cl_kernel kernel = clCreateKernel(program, kernel_name.c_str(), &cl_error);
+        
+        if (cl_error != CL_SUCCESS) {
+            printf("OpenCL program %s has no kernel %s\n", path.c_str(), kernel_name.c_str());
+            return false;
+        }
+        
+        clReleaseKernel(kernel);
+    }
+    
+    return true;
+}
+
+std::vector<std::string> ProgramReloader::get_source_files(std::string path)
+{
+    std::vector<std::string> source_files = {path};
+    
+    // Follow quoted includes, which are resolved against the directory of the including file.
+    for (unsigned int i = 0;i < source_files.size();i++) {
+        
+        std::string file_directory = source_files[i].substr(0, source_files[i].find_last_of('/') + 1);
+        std::istringstream source(utility::load_file(source_files[i]));
+        std::string line;
+        
+        while (std::getline(source, line)) {
+            
+            size_t directive = line.find("#include");
+            
+            if (directive == std::string::npos || line.find_first_not_of(" \t") != directive)
+                continue;
+            
+            size_t begin = line.find('"', directive);
+            size_t end = line.find('"', begin + 1);
+            
+            if (begin == std::string::npos || end == std::string::npos)
+                continue;
+            
+            std::string include_path = file_directory + line.substr(begin + 1, end - begin - 1);
+            
+            if (std::find(source_files.begin(), source_files.end(), include_path) == source_files.end())
+                source_files.push_back(include_path);
+        }
+    }
+    
+    return source_files;
+}
+
+void ProgramReloader::initialize(cl_context context, cl_device_id device)
+{
+    m_cl_context = context;
+    m_cl_device = device;
+    
+    m_build_thread = std::thread(&ProgramReloader::build_loop, this);
+}
+
+void ProgramReloader::request_build()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_build_mutex);
+        
+        m_is_build_requested = true;
+    }
+    
+    m_build_condition.notify_one();
+}
+
+void ProgramReloader::build_loop()
+{
+    while (true) {
+        
+        {
+            std::unique_lock<std::mutex> lock(m_build_mutex);
+            
+            m_build_condition.wait(lock, [this]{ return m_is_stopping || m_is_build_requested; });
+            
+            if (m_is_stopping)
+                return;
+            
+            m_is_build_requested = false;
+        }
+        
+        printf("Rebuilding OpenCL program %s\n", m_path.c_str());
+        
+        cl_program program = build_program(m_cl_context, m_cl_device, m_path, m_options, m_kernel_names);
+        
+        if (program == NULL)
+            continue;
+        
+        std::lock_guard<std::mutex> lock(m_build_mutex);
+        
+        // A newer build replaces one the render thread has not picked up yet.
+        if (m_cl_built_program != NULL)
+            clReleaseProgram(m_cl_built_program);
+        
+        m_cl_built_program = program;
+    }
+}
+
+cl_program ProgramReloader::take_built_program()
+{
+    std::lock_guard<std::mutex> lock(m_build_mutex);
+    
+    cl_program program = m_cl_built_program;
+    
+    m_cl_built_program = NULL;
+    
+    return program;
+}
+
+std::string ProgramReloader::get_path()
+{
+    return m_path;
+}
+
+std::string ProgramReloader::get_options()
+{
+    return m_options;
+}
+
+const std::vector<std::string> &ProgramReloader::get_kernel_names()
+{
+    return m_kernel_names;
+}
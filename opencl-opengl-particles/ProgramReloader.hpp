@@ -0,0 +1,76 @@
+//
+//  ProgramReloader.hpp
+//  opencl-opengl-particles
+//
+//  Rebuilds an OpenCL program on a worker thread, so a kernel edit never
+//  blocks the render thread in clBuildProgram. The new program is only
+//  handed over once it has built and contains every required kernel.
+//
+
+#ifndef ProgramReloader_hpp
+#define ProgramReloader_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <OpenCL/OpenCL.h>
+
+class ProgramReloader
+{
+private:
+    
+    cl_context m_cl_context;
+    cl_device_id m_cl_device;
+    
+    std::string m_path;
+    std::string m_options;
+    std::vector<std::string> m_kernel_names;
+    
+    std::thread m_build_thread;
+    std::mutex m_build_mutex;
+    std::condition_variable m_build_condition;
+    
+    bool m_is_build_requested = false;
+    bool m_is_stopping = false;
+    
+    cl_program m_cl_built_program = NULL;
+    
+    void build_loop();
+    
+public:
+    
+    ProgramReloader(std::string path, std::string options, std::vector<std::string> kernel_names)
+    {
+        m_path = path;
+        m_options = options;
+        m_kernel_names = kernel_names;
+    }
+    
+    ~ProgramReloader();
+    
+    // Builds the program synchronously, returning NULL and printing the build log on failure.
+    static cl_program build_program(cl_context context, cl_device_id device, std::string path, std::string options, const std::vector<std::string> &kernel_names);
+    
+    // Prints the first missing kernel and returns false if the program lacks any of them.
+    static bool has_kernels(cl_program program, std::string path, const std::vector<std::string> &kernel_names);
+    
+    // Returns the program source and every file it includes, relative to the working directory.
+    static std::vector<std::string> get_source_files(std::string path);
+    
+    void initialize(cl_context context, cl_device_id device);
+    
+    // Queues a rebuild, callable from any thread.
+    void request_build();
+    
+    // Returns a newly built program, or NULL. Call at a frame boundary; the caller owns the program.
+    cl_program take_built_program();
+    
+    std::string get_path();
+    std::string get_options();
+    const std::vector<std::string> &get_kernel_names();
+};
+
+#endif /* ProgramReloader_hpp */
@@ -12,92 +12,94 @@
 #include <GLFW/glfw3.h>
 
 #include <random>
+#include <stdlib.h>
+#include <algorithm>
+#include <string.h>
 
 #include "ParticleScene.hpp"
 #include "Utility.hpp"
 #include "ParticleMaterial.hpp"
 #include "VectorFieldMaterial.hpp"
+#include "ParticleVolumeMaterial.hpp"
+#include "ParticleTrailMaterial.hpp"
 #include "Texture.hpp"
 
-void ParticleScene::initialize_opencl()
+ParticleScene::~ParticleScene()
 {
-    cl_int cl_error;
-    
-    cl_platform_id cl_platform;
-    cl_uint number_of_platforms;
-    
-    // Get OpenCL platform.
-    cl_error = clGetPlatformIDs(1, &cl_platform, &number_of_platforms);
-    
-    CL_CHECK(cl_error);
-    
-    printf("Number of platforms: %u\n", number_of_platforms);
+    // Everything queued must finish before this scene's buffers go back to the pool.
+    if (m_cl_cmd_queue != NULL)
+        clFinish(m_cl_cmd_queue);
     
-    // Get OpenCL version.
-    char* info_string = new char[2048];
+    this->set_metrics_export(false);
     
-    cl_error = clGetPlatformInfo(cl_platform, CL_PLATFORM_VERSION, sizeof(info_string) * 128, info_string, NULL);
-    
-    printf("OpenCL version: %s\n", info_string);
-    
-    // Get GPU devices and info.
-    
-    cl_device_id cl_device;
-    cl_uint number_of_devices;
+    if (m_gui_window != NULL)
+        m_gui_window->dispose();
+}
+
+void ParticleScene::initialize_opencl()
+{
+    // The context, queue and built program outlive the scene, so switching back is warm.
+    OpenCLRuntime &runtime = OpenCLRuntime::get();
     
-    cl_error = clGetDeviceIDs(cl_platform, CL_DEVICE_TYPE_GPU, 1, &cl_device, &number_of_devices);
+    runtime.initialize();
     
-    printf("Number of devices: %u\n", number_of_devices);
+    m_cl_device = runtime.get_device();
+    m_cl_gl_context = runtime.get_context();
+    m_cl_cmd_queue = runtime.get_command_queue();
     
-    cl_error = clGetDeviceInfo(cl_device, CL_DEVICE_NAME, sizeof(info_string) * 128, info_string, NULL);
+    // Later rebuilds happen on the reloader's worker thread.
+    m_cl_program.reset(runtime.get_program(m_program_reloader.get_path(), m_program_reloader.get_options(), m_program_reloader.get_kernel_names()));
     
-    printf("Device name: %s\n", info_string);
+    // Every module creates its kernels from this program, there is nothing to run without it.
+    if (m_cl_program == NULL) {
+        printf("Error: OpenCL program %s could not be built, see the log above\n", m_program_reloader.get_path().c_str());
+        exit(EXIT_FAILURE);
+    }
     
-    // Set up OpenCL context.
+    m_program_reloader.initialize(m_cl_gl_context, m_cl_device);
     
-    CGLContextObj kCGLContext = CGLGetCurrentContext();
-    CGLShareGroupObj kCGLShareGroup = CGLGetShareGroup(kCGLContext);
-    cl_context_properties props[] =
-    {
-        CL_CONTEXT_PROPERTY_USE_CGL_SHAREGROUP_APPLE, (cl_context_properties)kCGLShareGroup,
-        0
-    };
+    // Create OpenCL kernels.
     
-    m_cl_gl_context = clCreateContext(props, 0, 0, NULL, NULL, &cl_error);
+    this->create_kernels();
     
-    printf("OpenCL context creation error: %u\n", cl_error);
+    m_statistics_reducer.initialize(m_cl_cmd_queue, m_cl_program);
+}
+
+void ParticleScene::create_kernels()
+{
+    cl_int cl_error;
     
-    // Set up OpenCL command queue.
-        
-    m_cl_cmd_queue = clCreateCommandQueue(m_cl_gl_context, cl_device, 0, &cl_error);
+    m_cl_krnl_particle_simulation.reset(clCreateKernel(m_cl_program, "particle_simulation", &cl_error));
     
-    printf("OpenCL command queue creation error: %u\n", cl_error);
+    CL_CHECK(cl_error);
     
-    // Set up OpenCL program.
+    m_cl_krnl_build_vector_field_glyphs.reset(clCreateKernel(m_cl_program, "build_vector_field_glyphs", &cl_error));
     
-    cl_program cl_prgm;
+    CL_CHECK(cl_error);
     
-    std::string program_source = utility::load_file("./Shaders/kerneltest.cl");
-    const char* program_source_char = program_source.c_str();
-    size_t program_length = strlen(program_source_char);
+    m_trajectory_exporter.create_kernels(m_cl_program);
+}
+
+void ParticleScene::swap_program(cl_program program)
+{
+    // Nothing may still be running with the old kernels.
+    clFinish(m_cl_cmd_queue);
     
-    cl_prgm = clCreateProgramWithSource(m_cl_gl_context, 1, &program_source_char, &program_length, &cl_error);
+    m_cl_program.reset(program);
     
-    printf("OpenCL program creation error: %u\n", cl_error);
+    // Scenes created later start from the rebuilt program.
+    OpenCLRuntime::get().set_program(m_program_reloader.get_path(), m_program_reloader.get_options(), program);
     
-    // Build OpenCL program.
+    this->create_kernels();
     
-    cl_error = clBuildProgram(cl_prgm, 0, NULL, "-cl-fast-relaxed-math", NULL, NULL);
+    m_statistics_reducer.create_kernels(m_cl_program);
+    m_particle_grid->create_kernels(m_cl_program);
+    m_obstacle_field->create_kernels(m_cl_program);
     
-    cl_error = clGetProgramBuildInfo(cl_prgm, cl_device, CL_PROGRAM_BUILD_LOG, sizeof(info_string) * 2048, info_string, NULL);
-
-    printf("OpenCL program build log: %s\n", info_string);
+    // The glyph kernel may have changed.
+    m_is_quiver_dirty = true;
     
-    CL_CHECK(cl_error);
-    
-    // Create OpenCL kernel.
-        
-    m_cl_krnl_particle_simulation = clCreateKernel(cl_prgm, "particle_simulation", &cl_error);
+    printf("Swapped in rebuilt OpenCL program %s\n", m_program_reloader.get_path().c_str());
 }
 
 void ParticleScene::run_particle_simulation(float delta_time)
@@ -113,29 +115,537 @@ void ParticleScene::run_particle_simulation(float delta_time)
     CL_CHECK( clEnqueueWriteBuffer(m_cl_cmd_queue, m_cl_vector_field_bounding_box, CL_TRUE, 0, sizeof(GLfloat) * 8, bounding_box_vertices.data(), NULL, NULL, NULL) );
     
     size_t global_work_size[] = {m_current_particle_count, 1};
-    cl_mem *gl_objects[] {&m_cl_particle_buffer, &m_cl_vector_field_texture};
+    cl_mem particle_grid_image = m_particle_grid->get_cl_image();
+    cl_mem obstacle_image = m_obstacle_field->get_cl_image();
+    cl_mem trail_buffer = m_particle_trails->get_cl_buffer();
+    std::vector<cl_mem> gl_objects = {m_cl_particle_buffer, m_cl_vector_field_texture, particle_grid_image, obstacle_image};
+    
+    if (trail_buffer != NULL)
+        gl_objects.push_back(trail_buffer);
+    
+    cl_uint trail_count = m_particle_trails->get_trail_count();
+    cl_uint trail_length = m_particle_trails->get_trail_length();
+    cl_uint trail_stride = m_particle_trails->get_sample_stride();
 
-    CL_CHECK( clEnqueueAcquireGLObjects(m_cl_cmd_queue, 2, gl_objects[0], NULL, NULL, NULL) );
+    CL_CHECK( clEnqueueAcquireGLObjects(m_cl_cmd_queue, (cl_uint) gl_objects.size(), gl_objects.data(), NULL, NULL, NULL) );
 
-    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 0, sizeof(m_cl_particle_buffer), &m_cl_particle_buffer) );
+    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 0, sizeof(cl_mem), m_cl_particle_buffer.get_address()) );
     
-    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 1, sizeof(m_cl_rng_seeds), &m_cl_rng_seeds) );
+    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 1, sizeof(cl_mem), m_cl_rng_seeds.get_address()) );
 
     CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 2, sizeof(m_cl_vector_field_texture), &m_cl_vector_field_texture) );
 
-    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 3, sizeof(m_cl_vector_field_bounding_box), &m_cl_vector_field_bounding_box) );
+    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 3, sizeof(cl_mem), m_cl_vector_field_bounding_box.get_address()) );
     
     CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 4, sizeof(float), &m_particle_tightness) );
 
     CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 5, sizeof(float), &delta_time) );
     
+    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 6, sizeof(particle_grid_image), &particle_grid_image) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 7, sizeof(float), &m_grid_coupling) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 8, sizeof(obstacle_image), &obstacle_image) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 9, sizeof(cl_int), &m_collision_mode) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 10, sizeof(trail_buffer), &trail_buffer) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 11, sizeof(cl_uint), &trail_count) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 12, sizeof(cl_uint), &trail_length) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 13, sizeof(cl_uint), &trail_stride) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 14, sizeof(cl_uint), &m_frame_index) );
+    
     CL_CHECK( clEnqueueNDRangeKernel(m_cl_cmd_queue, m_cl_krnl_particle_simulation, 2, NULL, global_work_size, NULL, 0, 0, 0) );
+    
+    std::static_pointer_cast<ParticleTrailMaterial>(m_particle_trails->get_mesh()->get_material())->set_trail_head(trail_length, m_frame_index % trail_length);
+    
+    m_trajectory_exporter.capture(m_cl_particle_buffer, m_frame_index++);
+    
+    m_statistics_reducer.reduce(m_cl_particle_buffer, m_cl_vector_field_bounding_box, m_current_particle_count, m_statistics_max_speed);
+    
+    // The grid is only needed to draw the volume or to feed the coupling term next frame.
+    if (m_is_rendering_volume || m_grid_coupling > 0.0f)
+        m_particle_grid->splat(m_cl_particle_buffer, m_cl_vector_field_bounding_box, m_current_particle_count);
+
+    CL_CHECK( clEnqueueReleaseGLObjects(m_cl_cmd_queue, (cl_uint) gl_objects.size(), gl_objects.data(), NULL, NULL, NULL) );
+
+    clFinish(m_cl_cmd_queue);
+    
+    // Queued after the finish so the readback overlaps rendering instead of delaying it.
+    m_trajectory_exporter.submit_readback();
+    m_statistics_reducer.submit_readback();
+}
+
+void ParticleScene::update_statistics()
+{
+    ParticleStatistics statistics;
+    
+    // Only the most recent completed readback is shown.
+    bool is_updated = false;
+    
+    while (m_statistics_reducer.poll(statistics))
+        is_updated = true;
+    
+    if (!is_updated)
+        return;
+    
+    char caption[128];
+    
+    snprintf(caption, sizeof(caption), "Speed: %.3f / %.3f / %.3f", statistics.speed_min, statistics.speed_mean, statistics.speed_max);
+    m_speed_statistics_label->setCaption(caption);
+    
+    snprintf(caption, sizeof(caption), "Life: %.3f / %.3f / %.3f", statistics.life_ratio_min, statistics.life_ratio_mean, statistics.life_ratio_max);
+    m_life_statistics_label->setCaption(caption);
+    
+    snprintf(caption, sizeof(caption), "In field: %u, outside: %u", statistics.inside_count, statistics.outside_count);
+    m_occupancy_statistics_label->setCaption(caption);
+    
+    if (m_metrics_file != NULL) {
+        
+        fprintf(m_metrics_file, "%u,%f,%f,%f,%f,%f,%f,%u,%u", m_frame_index,
+                statistics.speed_min, statistics.speed_mean, statistics.speed_max,
+                statistics.life_ratio_min, statistics.life_ratio_mean, statistics.life_ratio_max,
+                statistics.inside_count, statistics.outside_count);
+        
+        for (unsigned int i = 0;i < STATISTICS_HISTOGRAM_BINS;i++)
+            fprintf(m_metrics_file, ",%u", statistics.speed_histogram[i]);
+        
+        for (unsigned int i = 0;i < STATISTICS_HISTOGRAM_BINS;i++)
+            fprintf(m_metrics_file, ",%u", statistics.life_ratio_histogram[i]);
+        
+        fprintf(m_metrics_file, "\n");
+    }
+}
+
+void ParticleScene::set_metrics_export(bool is_exporting)
+{
+    if (!is_exporting) {
+        
+        if (m_metrics_file != NULL) {
+            fclose(m_metrics_file);
+            m_metrics_file = NULL;
+            
+            printf("Stopped writing metrics\n");
+        }
+        
+        return;
+    }
+    
+    if (m_metrics_file != NULL)
+        return;
+    
+    m_metrics_file = fopen("./particles_metrics.csv", "w");
+    
+    if (m_metrics_file == NULL) {
+        printf("Failed to open metrics file\n");
+        return;
+    }
+    
+    fprintf(m_metrics_file, "frame,speed_min,speed_mean,speed_max,life_min,life_mean,life_max,inside_count,outside_count");
+    
+    for (unsigned int i = 0;i < STATISTICS_HISTOGRAM_BINS;i++)
+        fprintf(m_metrics_file, ",speed_bin_%u", i);
+    
+    for (unsigned int i = 0;i < STATISTICS_HISTOGRAM_BINS;i++)
+        fprintf(m_metrics_file, ",life_bin_%u", i);
+    
+    fprintf(m_metrics_file, "\n");
+    
+    printf("Writing metrics to ./particles_metrics.csv\n");
+}
+
+void ParticleScene::set_parameter(SessionParameter parameter, double value)
+{
+    m_session.record(SESSION_EVENT_PARAMETER, parameter, 0, value);
+    
+    std::shared_ptr<VectorFieldMaterial> material = std::static_pointer_cast<VectorFieldMaterial>(m_vector_field_mesh->get_material());
+    
+    switch (parameter) {
+        case SESSION_PARAMETER_PARTICLE_COUNT:
+            m_current_particle_count = (unsigned int) value;
+            this->set_particle_count(m_current_particle_count);
+            break;
+            
+        case SESSION_PARAMETER_PARTICLE_TIGHTNESS:
+            m_particle_tightness = (float) value;
+            break;
+            
+        case SESSION_PARAMETER_GRID_COUPLING:
+            m_grid_coupling = (float) value;
+            break;
+            
+        case SESSION_PARAMETER_SAMPLE_POINTS_X:
+            material->set_field_sample_points_x((unsigned int) value);
+            m_is_quiver_dirty = true;
+            break;
+            
+        case SESSION_PARAMETER_SAMPLE_POINTS_Y:
+            material->set_field_sample_points_y((unsigned int) value);
+            m_is_quiver_dirty = true;
+            break;
+            
+        case SESSION_PARAMETER_SAMPLE_POINTS_Z:
+            m_vector_field_mesh->set_number_of_instances((unsigned int) value);
+            m_is_quiver_dirty = true;
+            break;
+            
+        case SESSION_PARAMETER_COLLISION_MODE:
+            m_collision_mode = (int) value;
+            
+            if (m_collision_mode != COLLISION_NONE && !m_obstacle_field->is_baked())
+                m_obstacle_field->bake();
+            
+            if (m_collision_combo_box != NULL)
+                m_collision_combo_box->setSelectedIndex(m_collision_mode);
+            break;
+            
+        case SESSION_PARAMETER_VECTOR_FIELD:
+            this->set_vector_field(m_vector_field_library->get_paths()[(size_t) value]);
+            break;
+    }
+}
+
+void ParticleScene::apply_session_event(const SessionEvent &event)
+{
+    switch (event.type) {
+        case SESSION_EVENT_PARAMETER:
+            this->set_parameter((SessionParameter) event.arguments[0], event.values[0]);
+            break;
+            
+        case SESSION_EVENT_KEY:
+            this->key_callback(event.arguments[0], event.arguments[1]);
+            break;
+            
+        case SESSION_EVENT_MOUSE_MOVE:
+            this->mouse_callback(event.values[0], event.values[1]);
+            break;
+            
+        case SESSION_EVENT_MOUSE_BUTTON:
+            this->mouse_button_callback(event.arguments[0], event.arguments[1], (int) event.values[0]);
+            break;
+            
+        case SESSION_EVENT_SCROLL:
+            this->scroll_callback(event.values[0], event.values[1]);
+            break;
+    }
+}
+
+uint64_t ParticleScene::checksum_particle_buffer()
+{
+    std::vector<GLfloat> particles(m_current_particle_count * 10);
+    
+    CL_CHECK( clEnqueueAcquireGLObjects(m_cl_cmd_queue, 1, m_cl_particle_buffer.get_address(), NULL, NULL, NULL) );
+    
+    CL_CHECK( clEnqueueReadBuffer(m_cl_cmd_queue, m_cl_particle_buffer, CL_TRUE, 0, sizeof(GLfloat) * particles.size(), particles.data(), 0, NULL, NULL) );
+    
+    CL_CHECK( clEnqueueReleaseGLObjects(m_cl_cmd_queue, 1, m_cl_particle_buffer.get_address(), NULL, NULL, NULL) );
+    
+    return SessionRecording::checksum(particles.data(), sizeof(GLfloat) * particles.size());
+}
+
+bool ParticleScene::record_session(std::string path)
+{
+    return m_session.start_recording(path, m_session_checksum_interval);
+}
+
+bool ParticleScene::replay_session(std::string path)
+{
+    return m_session.start_replay(path);
+}
+
+bool ParticleScene::is_session_finished()
+{
+    return m_session.is_finished();
+}
+
+void ParticleScene::set_fixed_time_step(double time_step)
+{
+    m_fixed_time_step = time_step;
+}
 
-    CL_CHECK( clEnqueueReleaseGLObjects(m_cl_cmd_queue, 2, gl_objects[0], NULL, NULL, NULL) );
+unsigned int ParticleScene::get_session_checksum_mismatches()
+{
+    return m_session.get_checksum_mismatches();
+}
 
+void ParticleScene::build_vector_field_glyphs()
+{
+    std::shared_ptr<VectorFieldMaterial> material = std::static_pointer_cast<VectorFieldMaterial>(m_vector_field_mesh->get_material());
+    
+    // Match the tessellated quiver: n levels give n + 1 points per axis, instances give the slices.
+    size_t global_work_size[] = {
+        material->get_field_sample_points_x() + 1,
+        material->get_field_sample_points_y() + 1,
+        m_vector_field_mesh->get_number_of_instances()
+    };
+    
+    // A zero tessellation level discards the patch, so draw nothing.
+    if (material->get_field_sample_points_x() == 0 || material->get_field_sample_points_y() == 0)
+        global_work_size[2] = 0;
+    
+    size_t number_of_glyphs = global_work_size[0] * global_work_size[1] * global_work_size[2];
+    
+    // Two line segments per glyph, each vertex a position and a colour.
+    std::vector<unsigned int> glyph_attributes = {4, 4};
+    std::vector<GLfloat> vertices(number_of_glyphs * 4 * 8);
+    
+    m_vector_field_glyph_mesh->initialize(vertices, glyph_attributes);
+    
+    m_cl_vector_field_glyph_buffer.reset();
+    
+    m_is_quiver_dirty = false;
+    
+    if (number_of_glyphs == 0)
+        return;
+    
+    cl_int cl_error;
+    
+    m_cl_vector_field_glyph_buffer.reset(clCreateFromGLBuffer(m_cl_gl_context, CL_MEM_WRITE_ONLY, m_vector_field_glyph_mesh->get_vertex_buffer_object(), &cl_error));
+    CL_CHECK(cl_error);
+    
+    cl_mem gl_objects[] = {m_cl_vector_field_glyph_buffer, m_cl_vector_field_texture};
+    
+    CL_CHECK( clEnqueueAcquireGLObjects(m_cl_cmd_queue, 2, gl_objects, NULL, NULL, NULL) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_build_vector_field_glyphs, 0, sizeof(cl_mem), m_cl_vector_field_glyph_buffer.get_address()) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_build_vector_field_glyphs, 1, sizeof(m_cl_vector_field_texture), &m_cl_vector_field_texture) );
+    
+    CL_CHECK( clEnqueueNDRangeKernel(m_cl_cmd_queue, m_cl_krnl_build_vector_field_glyphs, 3, NULL, global_work_size, NULL, 0, 0, 0) );
+    
+    CL_CHECK( clEnqueueReleaseGLObjects(m_cl_cmd_queue, 2, gl_objects, NULL, NULL, NULL) );
+    
     clFinish(m_cl_cmd_queue);
 }
 
+void ParticleScene::set_quiver_cached(bool is_cached)
+{
+    if (is_cached == m_is_quiver_cached)
+        return;
+    
+    m_is_quiver_cached = is_cached;
+    
+    if (m_is_quiver_cached) {
+        m_root_node->remove_child(m_vector_field_mesh);
+        m_root_node->add_child(m_vector_field_glyph_mesh);
+        
+        m_is_quiver_dirty = true;
+    }
+    else {
+        m_root_node->remove_child(m_vector_field_glyph_mesh);
+        m_root_node->add_child(m_vector_field_mesh);
+    }
+}
+
+void ParticleScene::set_rendering_volume(bool is_rendering_volume)
+{
+    if (is_rendering_volume == m_is_rendering_volume)
+        return;
+    
+    m_is_rendering_volume = is_rendering_volume;
+    
+    if (m_is_rendering_volume) {
+        m_root_node->remove_child(m_particle_mesh);
+        m_root_node->add_child(m_particle_volume_mesh);
+    }
+    else {
+        m_root_node->remove_child(m_particle_volume_mesh);
+        m_root_node->add_child(m_particle_mesh);
+    }
+}
+
+bool ParticleScene::set_vector_field(std::string path)
+{
+    const VectorFieldLibrary::VectorField *vector_field = m_vector_field_library->acquire(path);
+    
+    if (vector_field == NULL) {
+        printf("Keeping vector field %s\n", m_vector_field_path.c_str());
+        
+        const std::vector<std::string> &paths = m_vector_field_library->get_paths();
+        
+        if (m_vector_field_combo_box != NULL)
+            m_vector_field_combo_box->setSelectedIndex((int) (std::find(paths.begin(), paths.end(), m_vector_field_path) - paths.begin()));
+        
+        return false;
+    }
+    
+    m_vector_field_path = path;
+    m_cl_vector_field_texture = vector_field->cl_image;
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_particle_simulation, 2, sizeof(m_cl_vector_field_texture), &m_cl_vector_field_texture) );
+    
+    std::static_pointer_cast<VectorFieldMaterial>(m_vector_field_mesh->get_material())->set_vector_field_texture(vector_field->texture_id);
+    
+    m_is_quiver_dirty = true;
+    
+    // The next switch is most likely to a neighbour in the list.
+    const std::vector<std::string> &paths = m_vector_field_library->get_paths();
+    
+    std::vector<std::string>::const_iterator it = std::find(paths.begin(), paths.end(), path);
+    
+    if (it != paths.end()) {
+        size_t index = it - paths.begin();
+        
+        // Keys, checkpoints and replays switch fields too, keep the GUI in step.
+        if (m_vector_field_combo_box != NULL)
+            m_vector_field_combo_box->setSelectedIndex((int) index);
+        
+        m_vector_field_library->prefetch(paths[(index + 1) % paths.size()]);
+        m_vector_field_library->prefetch(paths[(index + paths.size() - 1) % paths.size()]);
+    }
+    return true;
+}
+
+void ParticleScene::cycle_vector_field(int offset)
+{
+    const std::vector<std::string> &paths = m_vector_field_library->get_paths();
+    
+    size_t index = std::find(paths.begin(), paths.end(), m_vector_field_path) - paths.begin();
+    
+    if (index == paths.size())
+        index = 0;
+    
+    this->set_parameter(SESSION_PARAMETER_VECTOR_FIELD, (double) ((index + paths.size() + offset) % paths.size()));
+}
+
+void ParticleScene::initialize_particle_trails()
+{
+    std::shared_ptr<Shader> particle_trail_shader(new Shader());
+    
+    particle_trail_shader->set_shader("./Shaders/particle_trail.vert", GL_VERTEX_SHADER);
+    particle_trail_shader->set_shader("./Shaders/particle_trail.frag", GL_FRAGMENT_SHADER);
+    particle_trail_shader->initialize();
+    
+    m_particle_trails = std::make_shared<ParticleTrails>(32, 50, m_trail_memory_budget);
+    m_particle_trails->initialize(std::make_shared<ParticleTrailMaterial>(particle_trail_shader));
+    
+    m_shader_reloader->add_files_to_watch([=]{
+        
+        m_renderer->queue_function_before_render([particle_trail_shader] {
+            particle_trail_shader->delete_shader();
+            particle_trail_shader->initialize();
+        });
+    },
+                                    "./Shaders/particle_trail.frag",
+                                    "./Shaders/particle_trail.vert"
+                                    );
+}
+
+void ParticleScene::set_drawing_trails(bool is_drawing_trails)
+{
+    if (is_drawing_trails == m_is_drawing_trails)
+        return;
+    
+    m_is_drawing_trails = is_drawing_trails;
+    
+    // Only hold the ring while trails are shown.
+    if (m_is_drawing_trails) {
+        m_particle_trails->resize(m_cl_gl_context, m_current_particle_count);
+        m_root_node->add_child(m_particle_trails->get_mesh());
+        
+        printf("Trails: %u particles, %u segments each, %zu bytes\n", m_particle_trails->get_trail_count(), m_particle_trails->get_trail_length(), m_particle_trails->get_memory_footprint());
+    }
+    else {
+        m_root_node->remove_child(m_particle_trails->get_mesh());
+        m_particle_trails->resize(m_cl_gl_context, 0);
+    }
+}
+
+void ParticleScene::initialize_obstacle_field()
+{
+    m_obstacle_field = std::make_shared<ObstacleField>(64);
+    m_obstacle_field->initialize(m_cl_gl_context, m_cl_cmd_queue, m_cl_program);
+    
+    // Obstacles are in vector field space so they follow the field around.
+    if (!m_obstacle_field->add_obj(m_obstacle_path)) {
+        
+        printf("No obstacle mesh at %s, using a sphere\n", m_obstacle_path.c_str());
+        
+        m_obstacle_field->clear();
+        m_obstacle_field->add_sphere(glm::vec3(0.0f), 0.35f);
+    }
+    
+    // Baked when collisions are first turned on, the kernel never reads the volume before that.
+    if (m_collision_mode != COLLISION_NONE)
+        m_obstacle_field->bake();
+}
+
+void ParticleScene::initialize_particle_grid()
+{
+    m_particle_grid = std::make_shared<ParticleGrid>(64);
+    m_particle_grid->initialize(m_cl_gl_context, m_cl_cmd_queue, m_cl_program);
+    
+    std::shared_ptr<Shader> particle_volume_shader(new Shader());
+    
+    particle_volume_shader->set_shader("./Shaders/particle_volume.vert", GL_VERTEX_SHADER);
+    particle_volume_shader->set_shader("./Shaders/particle_volume.frag", GL_FRAGMENT_SHADER);
+    particle_volume_shader->initialize();
+    
+    std::shared_ptr<ParticleVolumeMaterial> particle_volume_material( new ParticleVolumeMaterial(particle_volume_shader, m_particle_grid->get_texture_id()) );
+    
+    // Cube over the vector field, the fragment shader marches through it.
+    std::vector<GLfloat> corners = {
+        -1.0, -1.0,  1.0, 1.0,
+         1.0, -1.0,  1.0, 1.0,
+         1.0,  1.0,  1.0, 1.0,
+        -1.0,  1.0,  1.0, 1.0,
+        -1.0, -1.0, -1.0, 1.0,
+         1.0, -1.0, -1.0, 1.0,
+         1.0,  1.0, -1.0, 1.0,
+        -1.0,  1.0, -1.0, 1.0
+    };
+    
+    std::vector<GLuint> indices = {
+        // front
+        0, 1, 2,
+        2, 3, 0,
+        // top
+        1, 5, 6,
+        6, 2, 1,
+        // back
+        7, 6, 5,
+        5, 4, 7,
+        // bottom
+        4, 0, 3,
+        3, 7, 4,
+        // left
+        4, 5, 1,
+        1, 0, 4,
+        // right
+        3, 2, 6,
+        6, 7, 3,
+    };
+    
+    std::vector<GLfloat> vertices;
+    
+    for (GLuint index : indices)
+        vertices.insert(vertices.end(), corners.begin() + index * 4, corners.begin() + index * 4 + 4);
+    
+    std::vector<unsigned int> attributes = {4};
+    
+    m_particle_volume_mesh = std::make_shared<Mesh>();
+    m_particle_volume_mesh->initialize(vertices, attributes);
+    m_particle_volume_mesh->set_material(particle_volume_material);
+    m_particle_volume_mesh->set_position( m_vector_field_mesh->get_position() );
+    m_particle_volume_mesh->set_scale( m_vector_field_mesh->get_scale() );
+    m_particle_volume_mesh->set_rendering_mode(GL_TRIANGLES);
+    
+    m_shader_reloader->add_files_to_watch([=]{
+        
+        m_renderer->queue_function_before_render([particle_volume_shader] {
+            particle_volume_shader->delete_shader();
+            particle_volume_shader->initialize();
+        });
+    },
+                                    "./Shaders/particle_volume.frag",
+                                    "./Shaders/particle_volume.vert"
+                                    );
+}
+
 void ParticleScene::initialize_vector_field()
 {
     std::shared_ptr<Shader> vector_field_shader(new Shader());
@@ -147,8 +657,6 @@ void ParticleScene::initialize_vector_field()
     vector_field_shader->set_shader("./Shaders/vector_field.frag", GL_FRAGMENT_SHADER);
     vector_field_shader->initialize();
     
-    std::shared_ptr<Texture> vector_field_texture( new Texture(2,2,2) );
-    
     std::vector<GLfloat> pixels = {
         
         1.0, 0.0, 0.0, 1.0,
@@ -162,14 +670,32 @@ void ParticleScene::initialize_vector_field()
         0.0, 1.0, 0.0, 1.0
     };
     
-    vector_field_texture->initialize("./VF_Turbulence.fga");
+    // Fields stay resident on the device, so switching between them, or between scenes, only rebinds.
+    m_vector_field_library = OpenCLRuntime::get().get_vector_field_library(std::vector<std::string>{
+        "./VF_Turbulence.fga",
+        "./VF_Vortex.fga",
+        "./VF_Wind.fga",
+        "./VF_Smoke.fga",
+        "./VF_Point.fga",
+        "./VF_FluidVol.fga"
+    }, m_vector_field_memory_budget);
+    
+    const VectorFieldLibrary::VectorField *vector_field = m_vector_field_library->acquire(m_vector_field_path);
+    
+    // An unreadable default falls back to the first field in the library that loads.
+    for (size_t i = 0;vector_field == NULL && i < m_vector_field_library->get_paths().size();i++) {
+        m_vector_field_path = m_vector_field_library->get_paths()[i];
+        vector_field = m_vector_field_library->acquire(m_vector_field_path);
+    }
     
-    // Create OpenCL texture object.
-    cl_int cl_error;
-    m_cl_vector_field_texture = clCreateFromGLTexture(m_cl_gl_context, CL_MEM_READ_WRITE, GL_TEXTURE_3D, 0, vector_field_texture->get_texture_id(), &cl_error);
-    CL_CHECK(cl_error);
+    if (vector_field == NULL) {
+        printf("Error: none of the vector fields could be loaded\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    m_cl_vector_field_texture = vector_field->cl_image;
     
-    std::shared_ptr<VectorFieldMaterial> vector_field_material( new VectorFieldMaterial(vector_field_shader, vector_field_texture) );
+    std::shared_ptr<VectorFieldMaterial> vector_field_material( new VectorFieldMaterial(vector_field_shader, vector_field->texture_id) );
     
     m_vector_field_mesh = std::make_shared<Mesh>();
     
@@ -231,10 +757,25 @@ void ParticleScene::initialize_vector_field()
     m_vector_field_mesh->set_number_of_instances(10);
     glPatchParameteri(GL_PATCH_VERTICES, 8);
     
-    m_cl_vector_field_bounding_box = clCreateBuffer(m_cl_gl_context, CL_MEM_READ_ONLY, sizeof(GLfloat) * 8, NULL, &cl_error);
-    CL_CHECK(cl_error);
+    m_cl_vector_field_bounding_box = OpenCLRuntime::get().acquire_buffer(CL_MEM_READ_ONLY, sizeof(GLfloat) * 8);
+    
+    // Cached quiver, built into a vertex buffer by OpenCL and drawn as plain lines.
+    std::shared_ptr<Shader> vector_field_glyph_shader(new Shader());
+    
+    vector_field_glyph_shader->set_shader("./Shaders/vector_field_glyph.vert", GL_VERTEX_SHADER);
+    vector_field_glyph_shader->set_shader("./Shaders/vector_field_glyph.frag", GL_FRAGMENT_SHADER);
+    vector_field_glyph_shader->initialize();
+    
+    m_vector_field_glyph_mesh = std::make_shared<Mesh>();
+    m_vector_field_glyph_mesh->set_material(std::make_shared<Material>(vector_field_glyph_shader));
+    m_vector_field_glyph_mesh->set_position( m_vector_field_mesh->get_position() );
+    m_vector_field_glyph_mesh->set_scale( m_vector_field_mesh->get_scale() );
+    m_vector_field_glyph_mesh->set_rendering_mode(GL_LINES);
     
-    m_root_node->add_child(m_vector_field_mesh);
+    if (m_is_quiver_cached)
+        m_root_node->add_child(m_vector_field_glyph_mesh);
+    else
+        m_root_node->add_child(m_vector_field_mesh);
     
     m_shader_reloader->add_files_to_watch([=]{
         
@@ -249,12 +790,26 @@ void ParticleScene::initialize_vector_field()
                                     "./Shaders/vector_field.tesc",
                                     "./Shaders/vector_field.tese"
                                     );
+    
+    m_shader_reloader->add_files_to_watch([=]{
+        
+        m_renderer->queue_function_before_render([vector_field_glyph_shader] {
+            vector_field_glyph_shader->delete_shader();
+            vector_field_glyph_shader->initialize();
+        });
+    },
+                                    "./Shaders/vector_field_glyph.frag",
+                                    "./Shaders/vector_field_glyph.vert"
+                                    );
 }
 
 void ParticleScene::initialize(nanogui::Screen *gui_screen)
 {
     this->initialize_opencl();
     this->initialize_vector_field();
+    this->initialize_particle_grid();
+    this->initialize_obstacle_field();
+    this->initialize_particle_trails();
     
     std::shared_ptr<Shader> particle_shader( new Shader() );
     
@@ -276,6 +831,17 @@ void ParticleScene::initialize(nanogui::Screen *gui_screen)
     
     this->set_particle_count(m_current_particle_count);
     
+    // Kernel reloading, built in the background and swapped in by draw().
+    for (std::string source_file : ProgramReloader::get_source_files(m_program_reloader.get_path())) {
+        
+        m_shader_reloader->add_files_to_watch([=]{
+            
+            m_program_reloader.request_build();
+        },
+                                        source_file
+                                        );
+    }
+    
     //Shader reloading.    
     m_shader_reloader->add_files_to_watch
     ([=]{
@@ -305,6 +871,8 @@ void ParticleScene::initialize_gui(nanogui::Screen *gui_screen)
     // Add GUI window.
     nanogui::Window *gui_window = new nanogui::Window(gui_screen, "Particles");
     
+    m_gui_window = gui_window;
+    
     // Setup theme.
     nanogui::Theme *theme = gui_window->theme();
     theme->mWindowFillUnfocused = nanogui::Color(0, 0, 0, 0);
@@ -329,21 +897,35 @@ void ParticleScene::initialize_gui(nanogui::Screen *gui_screen)
                             
                             printf("Final slider value: %u\n", new_particle_count);
                             
-                            m_current_particle_count = new_particle_count;
-                            
-                            this->set_particle_count(m_current_particle_count);
+                            this->set_parameter(SESSION_PARAMETER_PARTICLE_COUNT, new_particle_count);
                         });
     
     
     // Vector field GUI.
     
+    std::vector<std::string> vector_field_names;
+    
+    for (const std::string &path : m_vector_field_library->get_paths())
+        vector_field_names.push_back(path.substr(path.find_last_of('/') + 1));
+    
+    new nanogui::Label(gui_window, "Vector field", "sans-bold");
+    
+    const std::vector<std::string> &vector_field_paths = m_vector_field_library->get_paths();
+    
+    m_vector_field_combo_box = new nanogui::ComboBox(gui_window, vector_field_names);
+    m_vector_field_combo_box->setSelectedIndex((int) (std::find(vector_field_paths.begin(), vector_field_paths.end(), m_vector_field_path) - vector_field_paths.begin()));
+    m_vector_field_combo_box->setCallback([=](int index) {
+        
+        this->set_parameter(SESSION_PARAMETER_VECTOR_FIELD, index);
+    });
+    
     float maximum_sample_points = 20.0f;
     
     //-------------------------------------------
     
     std::shared_ptr<VectorFieldMaterial> material = std::static_pointer_cast<VectorFieldMaterial>(m_vector_field_mesh->get_material());
 
-    new_variable_slider(
+    m_sample_points_sliders[0] = new_variable_slider(
                         gui_window,
                         "Vector field points x",
                         (float)material->get_field_sample_points_x() / maximum_sample_points,
@@ -353,13 +935,13 @@ void ParticleScene::initialize_gui(nanogui::Screen *gui_screen)
                             
                             unsigned int new_sample_points_count = (unsigned int) (value * maximum_sample_points);
                             
-                            material->set_field_sample_points_x(new_sample_points_count);
+                            this->set_parameter(SESSION_PARAMETER_SAMPLE_POINTS_X, new_sample_points_count);
                         },
                         [](float value){});
     
     //-------------------------------------------
     
-    new_variable_slider(
+    m_sample_points_sliders[1] = new_variable_slider(
                         gui_window,
                         "Vector field points y",
                         (float)material->get_field_sample_points_y() / maximum_sample_points,
@@ -369,13 +951,13 @@ void ParticleScene::initialize_gui(nanogui::Screen *gui_screen)
                             
                             unsigned int new_sample_points_count = (unsigned int) (value * maximum_sample_points);
                             
-                            material->set_field_sample_points_y(new_sample_points_count);
+                            this->set_parameter(SESSION_PARAMETER_SAMPLE_POINTS_Y, new_sample_points_count);
                         },
                         [](float value){});
     
     //-------------------------------------------
     
-    new_variable_slider(
+    m_sample_points_sliders[2] = new_variable_slider(
                         gui_window,
                         "Vector field points z",
                         (float)m_vector_field_mesh->get_number_of_instances() / maximum_sample_points,
@@ -385,13 +967,13 @@ void ParticleScene::initialize_gui(nanogui::Screen *gui_screen)
                             
                             unsigned int new_sample_points_count = (unsigned int) (value * maximum_sample_points);
                             
-                            m_vector_field_mesh->set_number_of_instances(new_sample_points_count);
+                            this->set_parameter(SESSION_PARAMETER_SAMPLE_POINTS_Z, new_sample_points_count);
                         },
                         [](float value){});
     
     //-------------------------------------------
     
-    new_variable_slider(
+    m_particle_tightness_slider = new_variable_slider(
                         gui_window,
                         "Particle tightness",
                         (float)m_particle_tightness / 1.0f,
@@ -399,9 +981,115 @@ void ParticleScene::initialize_gui(nanogui::Screen *gui_screen)
                         1.0f,
                         [=](float value) {
                             
-                            m_particle_tightness = value;
+                            this->set_parameter(SESSION_PARAMETER_PARTICLE_TIGHTNESS, value);
+                        },
+                        [](float value){});
+    
+    //-------------------------------------------
+    
+    m_grid_coupling_slider = new_variable_slider(
+                        gui_window,
+                        "Grid coupling",
+                        m_grid_coupling / 1.0f,
+                        0.0f,
+                        1.0f,
+                        [=](float value) {
+                            
+                            this->set_parameter(SESSION_PARAMETER_GRID_COUPLING, value);
+                        },
+                        [](float value){});
+    
+    //-------------------------------------------
+    
+    new nanogui::Label(gui_window, "Obstacle collisions", "sans-bold");
+    
+    m_collision_combo_box = new nanogui::ComboBox(gui_window, {"None", "Bounce", "Slide", "Kill"});
+    m_collision_combo_box->setSelectedIndex(m_collision_mode);
+    m_collision_combo_box->setCallback([=](int index) {
+        
+        this->set_parameter(SESSION_PARAMETER_COLLISION_MODE, index);
+    });
+    
+    //-------------------------------------------
+    
+    std::shared_ptr<ParticleVolumeMaterial> volume_material = std::static_pointer_cast<ParticleVolumeMaterial>(m_particle_volume_mesh->get_material());
+    
+    new_variable_slider(
+                        gui_window,
+                        "Volume density",
+                        0.25f,
+                        0.0f,
+                        4.0f,
+                        [=](float value) {
+                            
+                            volume_material->set_density_scale(value * 4.0f);
                         },
                         [](float value){});
+    
+    nanogui::CheckBox *volume_checkbox = new nanogui::CheckBox(gui_window, "Volume rendering");
+    volume_checkbox->setChecked(m_is_rendering_volume);
+    volume_checkbox->setCallback([=](bool is_checked) {
+        
+        this->set_rendering_volume(is_checked);
+    });
+    
+    //-------------------------------------------
+    
+    // Trails, the ring is resized when a slider is released.
+    new_variable_slider(
+                        gui_window,
+                        "Trail length",
+                        (m_particle_trails->get_trail_length() - 2) / 126.0f,
+                        2,
+                        128,
+                        [](float value){},
+                        [=](float value) {
+                            
+                            m_particle_trails->set_trail_length((unsigned int) (2 + value * 126));
+                            
+                            if (m_is_drawing_trails)
+                                m_particle_trails->resize(m_cl_gl_context, m_current_particle_count);
+                        });
+    
+    new_variable_slider(
+                        gui_window,
+                        "Trail particle stride",
+                        (m_particle_trails->get_sample_stride() - 1) / 999.0f,
+                        1,
+                        1000,
+                        [](float value){},
+                        [=](float value) {
+                            
+                            m_particle_trails->set_sample_stride((unsigned int) (1 + value * 999));
+                            
+                            if (m_is_drawing_trails)
+                                m_particle_trails->resize(m_cl_gl_context, m_current_particle_count);
+                        });
+    
+    nanogui::CheckBox *trail_checkbox = new nanogui::CheckBox(gui_window, "Particle trails");
+    trail_checkbox->setChecked(m_is_drawing_trails);
+    trail_checkbox->setCallback([=](bool is_checked) {
+        
+        this->set_drawing_trails(is_checked);
+    });
+    
+    //-------------------------------------------
+    
+    // Statistics, reduced on the device every frame.
+    new nanogui::Label(gui_window, "Statistics (min / mean / max)", "sans-bold");
+    
+    m_speed_statistics_label = new nanogui::Label(gui_window, "Speed: -");
+    m_life_statistics_label = new nanogui::Label(gui_window, "Life: -");
+    m_occupancy_statistics_label = new nanogui::Label(gui_window, "In field: -");
+    
+    //-------------------------------------------
+    
+    nanogui::CheckBox *quiver_cache_checkbox = new nanogui::CheckBox(gui_window, "Cache quiver glyphs");
+    quiver_cache_checkbox->setChecked(m_is_quiver_cached);
+    quiver_cache_checkbox->setCallback([=](bool is_checked) {
+        
+        this->set_quiver_cached(is_checked);
+    });
 }
 
 void ParticleScene::set_particle_count(unsigned int particle_count)
@@ -412,8 +1100,8 @@ void ParticleScene::set_particle_count(unsigned int particle_count)
 
     std::vector<GLfloat> vertices(particle_count * total_attributes);
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    // Seeded through the session so replays start from the same particles.
+    std::mt19937 gen(m_session.next_seed());
     std::uniform_real_distribution<float> position_distribution(-1, 1);
     std::uniform_real_distribution<float> velocity_distribution(0, 0);
     std::uniform_real_distribution<float> life_distribution(0, 100);
@@ -437,13 +1125,6 @@ void ParticleScene::set_particle_count(unsigned int particle_count)
         vertices[i * total_attributes + 9] =   life_distribution(gen);
     }
     
-    m_particle_mesh->initialize(vertices, particle_attributes);
-    
-    // Regain GL buffer in CL as it has been changed.
-    cl_int cl_error;
-        
-    m_cl_particle_buffer = clCreateFromGLBuffer(m_cl_gl_context, CL_MEM_READ_WRITE, m_particle_mesh->get_vertex_buffer_object(), &cl_error);
-    
     // Generate seeds.
     
     std::vector<unsigned int> rng_seeds(particle_count * 2);
@@ -453,17 +1134,218 @@ void ParticleScene::set_particle_count(unsigned int particle_count)
     for(unsigned int i = 0;i < particle_count * 2;i++)
         rng_seeds[i] = rng_seed_distribution(gen);
     
-    m_cl_rng_seeds = clCreateBuffer(m_cl_gl_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, 2 * sizeof(unsigned int) * particle_count, rng_seeds.data(), &cl_error);
+    this->initialize_particle_buffers(vertices, rng_seeds.data(), particle_count);
+}
+
+void ParticleScene::initialize_particle_buffers(const std::vector<GLfloat> &vertices, const unsigned int *rng_seeds, unsigned int particle_count)
+{
+    std::vector<unsigned int> particle_attributes = {4, 4, 2};
+    
+    m_particle_mesh->initialize(vertices, particle_attributes);
+    m_particle_mesh_count = particle_count;
+    
+    this->share_particle_buffers(rng_seeds, particle_count);
+}
+
+void ParticleScene::initialize_particle_buffers(const GLfloat *vertices, const unsigned int *rng_seeds, unsigned int particle_count)
+{
+    std::vector<unsigned int> particle_attributes = {4, 4, 2};
+    
+    // The mesh layout only depends on the count, so it is only rebuilt when that changes.
+    if (particle_count != m_particle_mesh_count) {
+        m_particle_mesh->initialize(std::vector<GLfloat>(particle_count * 10), particle_attributes);
+        m_particle_mesh_count = particle_count;
+    }
+    
+    // OpenCL must be done with the old contents before they are replaced.
+    clFinish(m_cl_cmd_queue);
+    
+    glBindBuffer(GL_ARRAY_BUFFER, m_particle_mesh->get_vertex_buffer_object());
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 10 * particle_count, vertices, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    
+    this->share_particle_buffers(rng_seeds, particle_count);
+}
+
+void ParticleScene::share_particle_buffers(const unsigned int *rng_seeds, unsigned int particle_count)
+{
+    // The exported subset is only valid for one particle count.
+    if (m_trajectory_exporter.is_exporting()) {
+        printf("Particle count changed, stopping trajectory export\n");
+        m_trajectory_exporter.stop();
+    }
+    
+    // Regain GL buffer in CL as it has been changed.
+    cl_int cl_error;
+        
+    m_cl_particle_buffer.reset(clCreateFromGLBuffer(m_cl_gl_context, CL_MEM_READ_WRITE, m_particle_mesh->get_vertex_buffer_object(), &cl_error));
     CL_CHECK(cl_error);
+    
+    // Pooled, so the previous scene's seed buffer is reused for the same particle count.
+    m_cl_rng_seeds = OpenCLRuntime::get().acquire_buffer(CL_MEM_READ_WRITE, 2 * sizeof(unsigned int) * particle_count);
+    
+    CL_CHECK( clEnqueueWriteBuffer(m_cl_cmd_queue, m_cl_rng_seeds, CL_TRUE, 0, 2 * sizeof(unsigned int) * particle_count, rng_seeds, 0, NULL, NULL) );
+    
+    // The particles have moved, start the trails over.
+    if (m_is_drawing_trails)
+        m_particle_trails->resize(m_cl_gl_context, particle_count);
+}
+
+void ParticleScene::save_checkpoint(std::string path)
+{
+    std::shared_ptr<VectorFieldMaterial> material = std::static_pointer_cast<VectorFieldMaterial>(m_vector_field_mesh->get_material());
+    
+    SimulationCheckpointHeader header = {};
+    
+    header.particle_count = m_current_particle_count;
+    header.floats_per_particle = 10;
+    header.particle_tightness = m_particle_tightness;
+    header.field_sample_points_x = material->get_field_sample_points_x();
+    header.field_sample_points_y = material->get_field_sample_points_y();
+    header.field_sample_points_z = m_vector_field_mesh->get_number_of_instances();
+    header.collision_mode = m_collision_mode;
+    header.grid_coupling = m_grid_coupling;
+    
+    glm::vec3 position = m_vector_field_mesh->get_position();
+    glm::vec3 scale = m_vector_field_mesh->get_scale();
+    glm::quat orientation = m_vector_field_mesh->get_orientation();
+    
+    for (int i = 0;i < 3;i++) {
+        header.field_position[i] = position[i];
+        header.field_scale[i] = scale[i];
+    }
+    
+    header.field_orientation[0] = orientation.w;
+    header.field_orientation[1] = orientation.x;
+    header.field_orientation[2] = orientation.y;
+    header.field_orientation[3] = orientation.z;
+    
+    strncpy(header.field_path, m_vector_field_path.c_str(), sizeof(header.field_path) - 1);
+    
+    CL_CHECK( clEnqueueAcquireGLObjects(m_cl_cmd_queue, 1, m_cl_particle_buffer.get_address(), NULL, NULL, NULL) );
+    
+    m_checkpoint_writer.write_async(path, header, m_cl_cmd_queue, m_cl_particle_buffer, m_cl_rng_seeds);
+    
+    CL_CHECK( clEnqueueReleaseGLObjects(m_cl_cmd_queue, 1, m_cl_particle_buffer.get_address(), NULL, NULL, NULL) );
+}
+
+void ParticleScene::set_trajectory_export(bool is_exporting)
+{
+    if (!is_exporting) {
+        m_trajectory_exporter.stop();
+        return;
+    }
+    
+    // Quantize across twice the vector field bounds, particles leaving the field are clamped.
+    // Every corner is needed as a rotated field's extent is not spanned by two opposite ones.
+    float bounds_min[] = {INFINITY, INFINITY, INFINITY};
+    float bounds_max[] = {-INFINITY, -INFINITY, -INFINITY};
+    
+    for (int i = 0;i < 8;i++) {
+        glm::vec4 corner = m_vector_field_mesh->get_model_matrix() * glm::vec4(i & 1 ? 2.0 : -2.0, i & 2 ? 2.0 : -2.0, i & 4 ? 2.0 : -2.0, 1.0);
+        
+        for (int axis = 0;axis < 3;axis++) {
+            bounds_min[axis] = std::min(bounds_min[axis], corner[axis]);
+            bounds_max[axis] = std::max(bounds_max[axis], corner[axis]);
+        }
+    }
+    
+    m_trajectory_exporter.start(m_trajectory_path, m_cl_cmd_queue, m_current_particle_count, m_trajectory_sample_stride, m_trajectory_frame_interval, bounds_min, bounds_max);
+}
+
+bool ParticleScene::restore_checkpoint(std::string path)
+{
+    SimulationCheckpointReader reader;
+    
+    if (!reader.open(path))
+        return false;
+    
+    const SimulationCheckpointHeader &header = reader.get_header();
+    
+    if (header.floats_per_particle != 10 || header.particle_count < m_minimum_particle_count || header.particle_count > m_maximum_particle_count) {
+        printf("Checkpoint %s does not match this simulation\n", path.c_str());
+        return false;
+    }
+    
+    // Only fields from the library may be loaded, the path comes from an untrusted file.
+    const std::vector<std::string> &paths = m_vector_field_library->get_paths();
+    std::string field_path(header.field_path, strnlen(header.field_path, sizeof(header.field_path)));
+    
+    if (std::find(paths.begin(), paths.end(), field_path) == paths.end()) {
+        printf("Checkpoint %s uses unknown vector field %s\n", path.c_str(), field_path.c_str());
+        return false;
+    }
+    
+    if (m_vector_field_path != field_path && !this->set_vector_field(field_path))
+        return false;
+    
+    // Simulation parameters, clamped to the slider ranges and applied through the sliders so the GUI matches.
+    set_slider_value(m_particle_tightness_slider, std::min(std::max(header.particle_tightness, 0.0f), 1.0f));
+    set_slider_value(m_grid_coupling_slider, std::min(std::max(header.grid_coupling, 0.0f), 1.0f));
+    
+    uint32_t sample_points[] = {header.field_sample_points_x, header.field_sample_points_y, header.field_sample_points_z};
+    SessionParameter sample_points_parameters[] = {SESSION_PARAMETER_SAMPLE_POINTS_X, SESSION_PARAMETER_SAMPLE_POINTS_Y, SESSION_PARAMETER_SAMPLE_POINTS_Z};
+    
+    // The sliders truncate, so the exact count is applied after moving them.
+    for (int i = 0;i < 3;i++) {
+        uint32_t count = std::min(std::max(sample_points[i], 1u), 20u);
+        
+        set_slider_value(m_sample_points_sliders[i], count / 20.0f);
+        set_parameter(sample_points_parameters[i], count);
+    }
+    
+    set_parameter(SESSION_PARAMETER_COLLISION_MODE, std::min(header.collision_mode, (uint32_t) COLLISION_KILL));
+    
+    // Vector field transform.
+    glm::vec3 position(header.field_position[0], header.field_position[1], header.field_position[2]);
+    glm::vec3 scale(header.field_scale[0], header.field_scale[1], header.field_scale[2]);
+    glm::quat orientation(header.field_orientation[0], header.field_orientation[1], header.field_orientation[2], header.field_orientation[3]);
+    
+    for (std::shared_ptr<Mesh> mesh : {m_vector_field_mesh, m_vector_field_glyph_mesh, m_particle_volume_mesh}) {
+        mesh->set_position(position);
+        mesh->set_scale(scale);
+        mesh->set_orientation(orientation);
+    }
+    
+    m_is_quiver_dirty = true;
+    
+    // Particle state, uploaded straight from the mapped file.
+    m_current_particle_count = header.particle_count;
+    
+    this->initialize_particle_buffers(reader.get_particle_data(), reader.get_rng_seed_data(), m_current_particle_count);
+    
+    m_last_time = glfwGetTime();
+    
+    printf("Checkpoint restored: %s (%u particles)\n", path.c_str(), m_current_particle_count);
+    
+    return true;
 }
 
 void ParticleScene::mouse_callback(double xpos, double ypos)
 {
+    m_session.record(SESSION_EVENT_MOUSE_MOVE, 0, 0, xpos, ypos);
+    
     Scene::mouse_callback(xpos, ypos);
 }
 
+void ParticleScene::mouse_button_callback(int button, int action, int modifiers)
+{
+    m_session.record(SESSION_EVENT_MOUSE_BUTTON, button, action, modifiers);
+    
+    Scene::mouse_button_callback(button, action, modifiers);
+}
+
+void ParticleScene::scroll_callback(double xoffset, double yoffset)
+{
+    m_session.record(SESSION_EVENT_SCROLL, 0, 0, xoffset, yoffset);
+    
+    Scene::scroll_callback(xoffset, yoffset);
+}
+
 void ParticleScene::key_callback(int key, int action)
 {
+    m_session.record(SESSION_EVENT_KEY, key, action);
+    
     Scene::key_callback(key, action);
     
     if(key == GLFW_KEY_E && action == GLFW_PRESS) {
@@ -477,20 +1359,85 @@ void ParticleScene::key_callback(int key, int action)
     else if(key == GLFW_KEY_O && action == GLFW_PRESS) {
         m_is_rotating = !m_is_rotating;
     }
+    
+    else if(key == GLFW_KEY_V && action == GLFW_PRESS) {
+        set_quiver_cached(!m_is_quiver_cached);
+    }
+    
+    else if(key == GLFW_KEY_F5 && action == GLFW_PRESS) {
+        save_checkpoint(m_checkpoint_path);
+    }
+    
+    else if(key == GLFW_KEY_F9 && action == GLFW_PRESS) {
+        restore_checkpoint(m_checkpoint_path);
+    }
+    
+    else if(key == GLFW_KEY_X && action == GLFW_PRESS) {
+        set_trajectory_export(!m_trajectory_exporter.is_exporting());
+    }
+    
+    else if(key == GLFW_KEY_LEFT_BRACKET && action == GLFW_PRESS) {
+        cycle_vector_field(-1);
+    }
+    
+    else if(key == GLFW_KEY_RIGHT_BRACKET && action == GLFW_PRESS) {
+        cycle_vector_field(1);
+    }
+    
+    else if(key == GLFW_KEY_G && action == GLFW_PRESS) {
+        set_rendering_volume(!m_is_rendering_volume);
+    }
+    
+    else if(key == GLFW_KEY_M && action == GLFW_PRESS) {
+        set_metrics_export(m_metrics_file == NULL);
+    }
+    
+    else if(key == GLFW_KEY_T && action == GLFW_PRESS) {
+        set_drawing_trails(!m_is_drawing_trails);
+    }
+    
+    else if(key == GLFW_KEY_C && action == GLFW_PRESS) {
+        set_parameter(SESSION_PARAMETER_COLLISION_MODE, (m_collision_mode + 1) % 4);
+    }
 }
 
 void ParticleScene::draw()
 {
+    // Replayed input lands on the same frame it was recorded on.
+    SessionEvent session_event;
+    
+    while (m_session.next_event(session_event))
+        this->apply_session_event(session_event);
+    
+    // Swap a rebuilt kernel program in at the frame boundary.
+    cl_program rebuilt_program = m_program_reloader.take_built_program();
+    
+    if (rebuilt_program != NULL)
+        this->swap_program(rebuilt_program);
+    
+    m_checkpoint_writer.update();
+    
+    m_vector_field_library->update();
+    
+    this->update_statistics();
+    
+    // Only rebuild the cached quiver when the field or its sampling has changed.
+    if (m_is_quiver_cached && m_is_quiver_dirty)
+        this->build_vector_field_glyphs();
+    
     Scene::draw();
     
+    double current_time = glfwGetTime();
+    double delta = m_session.next_frame_time(m_fixed_time_step > 0.0 ? m_fixed_time_step : current_time - m_last_time);
+    
     if (!m_is_paused) {
         
-        double current_time = glfwGetTime();
-        double delta = current_time - m_last_time;
-        
         ParticleScene::run_particle_simulation(delta / 3);
         
         m_last_time = current_time;
+        
+        if (m_session.is_checksum_frame(m_frame_index))
+            m_session.check(m_frame_index, this->checksum_particle_buffer());
     }
     
     if (m_is_rotating) {
@@ -16,6 +16,16 @@
 #include "Scene.hpp"
 #include "Mesh.hpp"
 #include "Utility.hpp"
+#include "SimulationCheckpoint.hpp"
+#include "TrajectoryExporter.hpp"
+#include "ParticleStatistics.hpp"
+#include "ParticleGrid.hpp"
+#include "ObstacleField.hpp"
+#include "ParticleTrails.hpp"
+#include "ProgramReloader.hpp"
+#include "VectorFieldLibrary.hpp"
+#include "SessionRecording.hpp"
+#include "OpenCLRuntime.hpp"
 
 class ParticleScene : public Scene
 {
@@ -24,31 +34,89 @@ private:
     unsigned int m_minimum_particle_count;
     unsigned int m_maximum_particle_count;
     unsigned int m_current_particle_count;
+    unsigned int m_particle_mesh_count = 0;
     float m_particle_tightness;
+    float m_grid_coupling;
+    int m_collision_mode;
+    
+    std::string m_vector_field_path;
+    std::string m_obstacle_path;
+    size_t m_vector_field_memory_budget;
+    size_t m_trail_memory_budget;
+    std::string m_checkpoint_path;
+    std::string m_trajectory_path;
+    
+    unsigned int m_trajectory_sample_stride;
+    unsigned int m_trajectory_frame_interval;
+    unsigned int m_frame_index = 0;
+    
+    float m_statistics_max_speed;
+    FILE *m_metrics_file = NULL;
     
     bool m_is_paused = false;
     bool m_is_rotating = false;
+    bool m_is_quiver_cached = true;
+    bool m_is_quiver_dirty = true;
+    bool m_is_rendering_volume = false;
+    bool m_is_drawing_trails = false;
     double m_last_time;
+    double m_fixed_time_step = 0.0;
     
     std::shared_ptr<Mesh> m_particle_mesh;
     std::shared_ptr<Mesh> m_vector_field_mesh;
+    std::shared_ptr<Mesh> m_vector_field_glyph_mesh;
+    std::shared_ptr<Mesh> m_particle_volume_mesh;
+    
+    std::shared_ptr<ParticleGrid> m_particle_grid;
+    std::shared_ptr<ObstacleField> m_obstacle_field;
+    std::shared_ptr<ParticleTrails> m_particle_trails;
+    std::shared_ptr<VectorFieldLibrary> m_vector_field_library;
+    
+    // Owned by the shared OpenCL runtime.
+    cl_device_id m_cl_device = NULL;
+    cl_context m_cl_gl_context = NULL;
+    cl_command_queue m_cl_cmd_queue = NULL;
     
-    cl_context m_cl_gl_context;
-    cl_command_queue m_cl_cmd_queue;
+    CLHandle<cl_program> m_cl_program;
     
-    cl_kernel m_cl_krnl_particle_simulation;
+    CLHandle<cl_kernel> m_cl_krnl_particle_simulation;
+    CLHandle<cl_kernel> m_cl_krnl_build_vector_field_glyphs;
     
-    cl_mem m_cl_particle_buffer;
+    ProgramReloader m_program_reloader;
+    
+    CLHandle<cl_mem> m_cl_particle_buffer;
     cl_mem m_cl_vector_field_texture;
-    cl_mem m_cl_vector_field_bounding_box;
-    cl_mem m_cl_rng_seeds;
+    CLHandle<cl_mem> m_cl_vector_field_glyph_buffer;
+    CLBuffer m_cl_vector_field_bounding_box;
+    CLBuffer m_cl_rng_seeds;
+    
+    SimulationCheckpointWriter m_checkpoint_writer;
+    TrajectoryExporter m_trajectory_exporter;
+    ParticleStatisticsReducer m_statistics_reducer;
+    SessionRecording m_session;
+    unsigned int m_session_checksum_interval;
+    
+    nanogui::Window *m_gui_window = NULL;
+    nanogui::Slider *m_particle_tightness_slider;
+    nanogui::Slider *m_grid_coupling_slider;
+    nanogui::Slider *m_sample_points_sliders[3];
+    nanogui::ComboBox *m_vector_field_combo_box = NULL;
+    nanogui::ComboBox *m_collision_combo_box = NULL;
+    nanogui::Label *m_speed_statistics_label;
+    nanogui::Label *m_life_statistics_label;
+    nanogui::Label *m_occupancy_statistics_label;
 
     void initialize_vector_field();
+    void initialize_particle_grid();
+    void initialize_obstacle_field();
+    void initialize_particle_trails();
     void initialize_opencl();
+    void create_kernels();
+    void swap_program(cl_program program);
     void initialize_gui(nanogui::Screen *gui_screen);
     
     template<typename T>
-    static void new_variable_slider(nanogui::Window *gui_window, std::string title, float initial_value, T min_slider_value, T max_slider_value, std::function<void(float)> callback, std::function<void(float)> final_callback)
+    static nanogui::Slider *new_variable_slider(nanogui::Window *gui_window, std::string title, float initial_value, T min_slider_value, T max_slider_value, std::function<void(float)> callback, std::function<void(float)> final_callback)
     {
         new nanogui::Label(gui_window, title, "sans-bold");
         
@@ -77,26 +145,94 @@ private:
         text_box->setAlignment(nanogui::TextBox::Alignment::Right);
         
         slider->callback()(initial_value);
+        
+        return slider;
+    }
+    
+    // Moves a slider and applies it, as if the user had dragged it there.
+    static void set_slider_value(nanogui::Slider *slider, float value)
+    {
+        slider->setValue(value);
+        slider->callback()(value);
     }
     
     void run_particle_simulation(float delta_time);
     
+    void build_vector_field_glyphs();
+    void set_quiver_cached(bool is_cached);
+    void set_rendering_volume(bool is_rendering_volume);
+    void set_drawing_trails(bool is_drawing_trails);
+    bool set_vector_field(std::string path);
+    void cycle_vector_field(int offset);
+    
     void set_particle_count(unsigned int particle_count);
+    void initialize_particle_buffers(const std::vector<GLfloat> &vertices, const unsigned int *rng_seeds, unsigned int particle_count);
+    void initialize_particle_buffers(const GLfloat *vertices, const unsigned int *rng_seeds, unsigned int particle_count);
+    void share_particle_buffers(const unsigned int *rng_seeds, unsigned int particle_count);
+    
+    void save_checkpoint(std::string path);
+    bool restore_checkpoint(std::string path);
+    
+    void set_trajectory_export(bool is_exporting);
+    
+    void update_statistics();
+    void set_metrics_export(bool is_exporting);
+    
+    // All GUI parameter changes go through here so sessions can record them.
+    void set_parameter(SessionParameter parameter, double value);
+    void apply_session_event(const SessionEvent &event);
+    uint64_t checksum_particle_buffer();
     
 public:
     
-    ParticleScene(int width, int height) : Scene(width, height)
+    ParticleScene(int width, int height) : Scene(width, height),
+        m_program_reloader("./Shaders/kerneltest.cl", "-cl-fast-relaxed-math -I ./Shaders", {
+            "particle_simulation",
+            "build_vector_field_glyphs",
+            "gather_trajectory_samples",
+            "reduce_particle_statistics",
+            "finalize_particle_statistics",
+            "splat_particle_grid",
+            "resolve_particle_grid",
+            "bake_obstacle_distance",
+            "bake_obstacle_gradient"
+        })
     {
         m_minimum_particle_count = 1;
         m_maximum_particle_count = 1000000;
         m_current_particle_count = 500000;
         m_particle_tightness = 0.0f;
+        m_grid_coupling = 0.0f;
+        m_collision_mode = COLLISION_NONE;
+        m_vector_field_path = "./VF_Turbulence.fga";
+        m_obstacle_path = "./obstacle.obj";
+        m_vector_field_memory_budget = 8 * 1024 * 1024;
+        m_trail_memory_budget = 16 * 1024 * 1024;
+        m_checkpoint_path = "./particles.checkpoint";
+        m_trajectory_path = "./particles.ptraj";
+        m_trajectory_sample_stride = 100;
+        m_trajectory_frame_interval = 2;
+        m_statistics_max_speed = 1.0f;
+        m_session_checksum_interval = 60;
     }
     
+    ~ParticleScene();
+    
     void initialize(nanogui::Screen *gui_screen);
     void draw();
     
+    // Must be called before initialize, the initial seed is part of the session.
+    bool record_session(std::string path);
+    bool replay_session(std::string path);
+    bool is_session_finished();
+    
+    // Simulates every frame with this step instead of the wall clock, zero to go back.
+    void set_fixed_time_step(double time_step);
+    unsigned int get_session_checksum_mismatches();
+    
     void mouse_callback(double xpos, double ypos);
+    void mouse_button_callback(int button, int action, int modifiers);
+    void scroll_callback(double xoffset, double yoffset);
     void key_callback(int key, int action);
 };
 
@@ -0,0 +1,254 @@
+//
+//  SessionRecording.cpp
+//  opencl-opengl-particles
+//
+//
+
+#include "SessionRecording.hpp"
+
+#include <string.h>
+#include <inttypes.h>
+#include <random>
+
+SessionRecording::~SessionRecording()
+{
+    this->stop();
+}
+
+bool SessionRecording::start_recording(std::string path, unsigned int checksum_interval)
+{
+    this->stop();
+    
+    m_file = fopen(path.c_str(), "wb");
+    
+    if (m_file == NULL) {
+        printf("Failed to open session recording %s\n", path.c_str());
+        return false;
+    }
+    
+    SessionRecordingHeader header = {};
+    
+    strncpy(header.magic, SESSION_RECORDING_MAGIC, sizeof(header.magic));
+    header.version = SESSION_RECORDING_VERSION;
+    header.checksum_interval = checksum_interval;
+    
+    fwrite(&header, sizeof(header), 1, m_file);
+    
+    m_checksum_interval = checksum_interval;
+    
+    printf("Recording session to %s\n", path.c_str());
+    
+    return true;
+}
+
+bool SessionRecording::start_replay(std::string path)
+{
+    this->stop();
+    
+    FILE *file = fopen(path.c_str(), "rb");
+    
+    if (file == NULL) {
+        printf("Failed to open session recording %s\n", path.c_str());
+        return false;
+    }
+    
+    SessionRecordingHeader header;
+    
+    if (fread(&header, sizeof(header), 1, file) != 1 || strncmp(header.magic, SESSION_RECORDING_MAGIC, sizeof(header.magic)) != 0) {
+        printf("%s is not a session recording\n", path.c_str());
+        fclose(file);
+        return false;
+    }
+    
+    if (header.version != SESSION_RECORDING_VERSION) {
+        printf("Unsupported session recording version %u in %s\n", header.version, path.c_str());
+        fclose(file);
+        return false;
+    }
+    
+    // A recording cut short by a crash is still replayable up to its last whole event.
+    SessionEvent event;
+    
+    while (fread(&event, sizeof(event), 1, file) == 1)
+        m_events.push_back(event);
+    
+    fclose(file);
+    
+    m_next_event = 0;
+    m_is_replaying = true;
+    m_checksum_interval = header.checksum_interval;
+    m_checksums_checked = 0;
+    m_checksum_mismatches = 0;
+    
+    printf("Replaying session %s (%zu events)\n", path.c_str(), m_events.size());
+    
+    return true;
+}
+
+void SessionRecording::stop()
+{
+    if (m_file != NULL) {
+        fclose(m_file);
+        m_file = NULL;
+    }
+    
+    if (m_is_replaying && m_checksums_checked > 0)
+        printf("Replay checksums: %u checked, %u mismatched\n", m_checksums_checked, m_checksum_mismatches);
+    
+    m_events.clear();
+    m_is_replaying = false;
+}
+
+bool SessionRecording::is_recording()
+{
+    return m_file != NULL;
+}
+
+bool SessionRecording::is_replaying()
+{
+    return m_is_replaying;
+}
+
+bool SessionRecording::is_finished()
+{
+    if (!m_is_replaying)
+        return false;
+    
+    for (size_t i = m_next_event; i < m_events.size(); i++) {
+        if (m_events[i].type == SESSION_EVENT_FRAME)
+            return false;
+    }
+    
+    return true;
+}
+
+void SessionRecording::write(const SessionEvent &event)
+{
+    fwrite(&event, sizeof(event), 1, m_file);
+}
+
+void SessionRecording::record(SessionEventType type, int argument0, int argument1, double value0, double value1)
+{
+    if (m_file == NULL)
+        return;
+    
+    SessionEvent event = {};
+    
+    event.type = type;
+    event.arguments[0] = argument0;
+    event.arguments[1] = argument1;
+    event.values[0] = value0;
+    event.values[1] = value1;
+    
+    this->write(event);
+}
+
+bool SessionRecording::next_event(SessionEvent &event)
+{
+    if (!m_is_replaying || m_next_event >= m_events.size())
+        return false;
+    
+    // Seeds and checksums are taken where they were recorded, not as input.
+    switch (m_events[m_next_event].type) {
+        case SESSION_EVENT_FRAME:
+        case SESSION_EVENT_SEED:
+        case SESSION_EVENT_CHECKSUM:
+            return false;
+    }
+    
+    event = m_events[m_next_event++];
+    
+    return true;
+}
+
+double SessionRecording::next_frame_time(double frame_time)
+{
+    if (m_is_replaying) {
+        
+        // Skip anything the replay did not consume, so one divergence does not derail the rest.
+        while (m_next_event < m_events.size() && m_events[m_next_event].type != SESSION_EVENT_FRAME)
+            m_next_event++;
+        
+        if (m_next_event == m_events.size())
+            return 0.0;
+        
+        return m_events[m_next_event++].values[0];
+    }
+    
+    this->record(SESSION_EVENT_FRAME, 0, 0, frame_time);
+    
+    return frame_time;
+}
+
+unsigned int SessionRecording::next_seed()
+{
+    if (m_is_replaying) {
+        
+        if (m_next_event < m_events.size() && m_events[m_next_event].type == SESSION_EVENT_SEED)
+            return (unsigned int) m_events[m_next_event++].arguments[0];
+        
+        printf("Replay expected a seed, the session has diverged\n");
+        
+        return 0;
+    }
+    
+    std::random_device rd;
+    unsigned int seed = rd();
+    
+    this->record(SESSION_EVENT_SEED, (int) seed);
+    
+    return seed;
+}
+
+bool SessionRecording::is_checksum_frame(unsigned int frame)
+{
+    if (m_checksum_interval == 0 || (!m_is_replaying && m_file == NULL))
+        return false;
+    
+    return frame % m_checksum_interval == 0;
+}
+
+void SessionRecording::check(unsigned int frame, uint64_t checksum)
+{
+    if (!m_is_replaying) {
+        
+        // Split in two halves, the arguments are 32 bit.
+        this->record(SESSION_EVENT_CHECKSUM, (int) frame, 0, (double) (uint32_t) (checksum >> 32), (double) (uint32_t) checksum);
+        return;
+    }
+    
+    if (m_next_event >= m_events.size() || m_events[m_next_event].type != SESSION_EVENT_CHECKSUM)
+        return;
+    
+    const SessionEvent &event = m_events[m_next_event++];
+    
+    uint64_t recorded_checksum = ((uint64_t) event.values[0] << 32) | (uint64_t) event.values[1];
+    
+    m_checksums_checked++;
+    
+    if (recorded_checksum != checksum || (unsigned int) event.arguments[0] != frame) {
+        
+        m_checksum_mismatches++;
+        
+        printf("Replay checksum mismatch at frame %u: %016" PRIx64 ", recorded %016" PRIx64 " at frame %d\n", frame, checksum, recorded_checksum, event.arguments[0]);
+    }
+}
+
+unsigned int SessionRecording::get_checksum_mismatches()
+{
+    return m_checksum_mismatches;
+}
+
+uint64_t SessionRecording::checksum(const void *data, size_t size)
+{
+    // FNV-1a, bitwise drift anywhere in the buffer changes it.
+    const unsigned char *bytes = (const unsigned char *) data;
+    uint64_t hash = 14695981039346656037ULL;
+    
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    
+    return hash;
+}
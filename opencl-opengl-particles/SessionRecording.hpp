@@ -0,0 +1,114 @@
+//
+//  SessionRecording.hpp
+//  opencl-opengl-particles
+//
+//  Records everything that drives a session, seeds, frame times, input and
+//  GUI parameter changes, so it can be replayed on an identical workload.
+//  Checksums of the particle buffer are logged at intervals and compared on
+//  replay to detect drift.
+//
+
+#ifndef SessionRecording_hpp
+#define SessionRecording_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define SESSION_RECORDING_MAGIC "PSSESS"
+#define SESSION_RECORDING_VERSION 1
+
+enum SessionEventType
+{
+    SESSION_EVENT_FRAME,
+    SESSION_EVENT_SEED,
+    SESSION_EVENT_PARAMETER,
+    SESSION_EVENT_KEY,
+    SESSION_EVENT_MOUSE_MOVE,
+    SESSION_EVENT_MOUSE_BUTTON,
+    SESSION_EVENT_SCROLL,
+    SESSION_EVENT_CHECKSUM
+};
+
+enum SessionParameter
+{
+    SESSION_PARAMETER_PARTICLE_COUNT,
+    SESSION_PARAMETER_PARTICLE_TIGHTNESS,
+    SESSION_PARAMETER_GRID_COUPLING,
+    SESSION_PARAMETER_SAMPLE_POINTS_X,
+    SESSION_PARAMETER_SAMPLE_POINTS_Y,
+    SESSION_PARAMETER_SAMPLE_POINTS_Z,
+    SESSION_PARAMETER_COLLISION_MODE,
+    SESSION_PARAMETER_VECTOR_FIELD
+};
+
+struct SessionRecordingHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t checksum_interval;
+};
+
+// Fixed size so the file is a plain array after the header.
+struct SessionEvent
+{
+    uint32_t type;
+    int32_t arguments[3];
+    double values[2];
+};
+
+class SessionRecording
+{
+private:
+    
+    FILE *m_file = NULL;
+    
+    std::vector<SessionEvent> m_events;
+    size_t m_next_event = 0;
+    
+    bool m_is_replaying = false;
+    
+    unsigned int m_checksum_interval = 0;
+    unsigned int m_checksums_checked = 0;
+    unsigned int m_checksum_mismatches = 0;
+    
+    void write(const SessionEvent &event);
+    
+public:
+    
+    ~SessionRecording();
+    
+    bool start_recording(std::string path, unsigned int checksum_interval);
+    bool start_replay(std::string path);
+    void stop();
+    
+    bool is_recording();
+    bool is_replaying();
+    
+    // True once a replay has run out of frames.
+    bool is_finished();
+    
+    // Logs an input or parameter event, ignored unless recording.
+    void record(SessionEventType type, int argument0, int argument1 = 0, double value0 = 0.0, double value1 = 0.0);
+    
+    // Replaying, pops the events recorded before the next frame.
+    bool next_event(SessionEvent &event);
+    
+    // Returns the frame time to simulate with, the recorded one when replaying.
+    double next_frame_time(double frame_time);
+    
+    // Returns a fresh seed, the recorded one when replaying.
+    unsigned int next_seed();
+    
+    bool is_checksum_frame(unsigned int frame);
+    
+    // Logs the checksum, or compares it against the recorded one.
+    void check(unsigned int frame, uint64_t checksum);
+    
+    unsigned int get_checksum_mismatches();
+    
+    static uint64_t checksum(const void *data, size_t size);
+};
+
+#endif /* SessionRecording_hpp */
@@ -10,6 +10,11 @@ struct __attribute__ ((packed)) Particle {
     float2 life;
 };
 
+#define COLLISION_NONE 0
+#define COLLISION_BOUNCE 1
+#define COLLISION_SLIDE 2
+#define COLLISION_KILL 3
+
 const sampler_t vector_field_sampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_CLAMP | CLK_FILTER_LINEAR;
 
 int is_between(float min, float max, float value)
@@ -35,7 +40,19 @@ inline float rand_float(__global uint2* rvec, float min, float max) {
     return min + rand * (max - min);
 }
 
-__kernel void particle_simulation(__global struct Particle* particles, __global uint2* rng_seeds, __read_only image3d_t vector_field, __constant struct BoundingBox* bounding_box, float tightness, float time)
+// Trails, every trail_stride'th particle writes this frame's segment into its ring.
+inline void write_trail_segment(__global float4* trails, unsigned int i, unsigned int trail_count, unsigned int trail_length, unsigned int trail_stride, unsigned int frame, float4 previous_pos, float4 pos)
+{
+    if(i % trail_stride == 0 && i / trail_stride < trail_count) {
+        
+        __global float4 *segment = &trails[((i / trail_stride) * trail_length + frame % trail_length) * 2];
+        
+        segment[0] = (float4)(previous_pos.xyz, 1.0f);
+        segment[1] = (float4)(pos.xyz, 1.0f);
+    }
+}
+
+__kernel void particle_simulation(__global struct Particle* particles, __global uint2* rng_seeds, __read_only image3d_t vector_field, __constant struct BoundingBox* bounding_box, float tightness, float time, __read_only image3d_t particle_grid, float grid_coupling, __read_only image3d_t obstacles, int collision_mode, __global float4* trails, unsigned int trail_count, unsigned int trail_length, unsigned int trail_stride, unsigned int frame)
 {
     unsigned int x = get_global_id(0);
     unsigned int y = get_global_id(1);
@@ -60,6 +77,8 @@ __kernel void particle_simulation(__global struct Particle* particles, __global
 //        return;
 //    }
     
+    float4 previous_pos = particle->pos;
+    
     particle->pos.xyz += particle->vel.xyz * time;
     
     float4 particle_pos_in_vector_field = particle->pos - bounding_box->corner1;
@@ -77,15 +96,490 @@ __kernel void particle_simulation(__global struct Particle* particles, __global
     }
     
     if(!is_inside_vector_field) {
+        write_trail_segment(trails, i, trail_count, trail_length, trail_stride, frame, previous_pos, particle->pos);
         return;
     }
     
+    // Obstacles, a single fetch gives the signed distance in w and its gradient in xyz.
+    float3 collision_normal = (float3)(0.0f);
+    
+    if(collision_mode != COLLISION_NONE) {
+        
+        float4 obstacle = read_imagef(obstacles, vector_field_sampler, particle_pos_in_vector_field);
+        
+        if(obstacle.w < 0.0f) {
+            
+            // The distance is in field coordinates, the field is scaled uniformly.
+            collision_normal = normalize(obstacle.xyz / vector_field_length.xyz);
+            
+            particle->pos.xyz -= collision_normal * obstacle.w * fabs(vector_field_length.x);
+            
+            if(collision_mode == COLLISION_KILL) {
+                particle->vel.xyz = (float3)(0.0f);
+                particle->life.x = particle->life.y;
+                write_trail_segment(trails, i, trail_count, trail_length, trail_stride, frame, previous_pos, particle->pos);
+                return;
+            }
+        }
+    }
+    
+    // Written once the obstacle push-out is done, so segments never cut into an obstacle.
+    write_trail_segment(trails, i, trail_count, trail_length, trail_stride, frame, previous_pos, particle->pos);
+    
     float4 voxel = (float4)(1.0f / float(get_image_width(vector_field)) / 2.0f, 1.0f / float(get_image_height(vector_field)) / 2.0f, 1.0f / float(get_image_depth(vector_field)) / 2.0f, 0.0f);
     voxel = mix(voxel, (float4)(1.0f) - voxel, particle_pos_in_vector_field);
     
     float4 acceleration = read_imagef(vector_field, vector_field_sampler, voxel);
     
+    // Two-way coupling, particles are pushed down the gradient of last frame's splatted density.
+    if(grid_coupling > 0.0f) {
+        
+        float4 grid_step = (float4)(1.0f / float(get_image_width(particle_grid)), 1.0f / float(get_image_height(particle_grid)), 1.0f / float(get_image_depth(particle_grid)), 0.0f);
+        
+        float4 density_gradient = (float4)(
+            read_imagef(particle_grid, vector_field_sampler, particle_pos_in_vector_field + (float4)(grid_step.x, 0.0f, 0.0f, 0.0f)).w - read_imagef(particle_grid, vector_field_sampler, particle_pos_in_vector_field - (float4)(grid_step.x, 0.0f, 0.0f, 0.0f)).w,
+            read_imagef(particle_grid, vector_field_sampler, particle_pos_in_vector_field + (float4)(0.0f, grid_step.y, 0.0f, 0.0f)).w - read_imagef(particle_grid, vector_field_sampler, particle_pos_in_vector_field - (float4)(0.0f, grid_step.y, 0.0f, 0.0f)).w,
+            read_imagef(particle_grid, vector_field_sampler, particle_pos_in_vector_field + (float4)(0.0f, 0.0f, grid_step.z, 0.0f)).w - read_imagef(particle_grid, vector_field_sampler, particle_pos_in_vector_field - (float4)(0.0f, 0.0f, grid_step.z, 0.0f)).w,
+            0.0f);
+        
+        acceleration.xyz -= grid_coupling * 0.1f * density_gradient.xyz;
+    }
+    
     particle->vel.xyz = particle->vel.xyz * tightness + acceleration.xyz * time;
+    
+    // The response goes on the integrated velocity, so tightness and the field cannot undo it.
+    float normal_speed = dot(particle->vel.xyz, collision_normal);
+    
+    if(normal_speed < 0.0f)
+        particle->vel.xyz -= (collision_mode == COLLISION_BOUNCE ? 1.5f : 1.0f) * normal_speed * collision_normal;
 //    particle->vel.xyz += acceleration.xyz * time;
 //    printf("\n%f, %f, %f, %f\n%f, %f, %f, %f\n%f, %f, %f, %f\n%f, %f, %f, %f\n\n", vector_field_length, particle_pos_in_vector_field, voxel, acceleration);
 }
+
+__kernel void gather_trajectory_samples(__global struct Particle* particles, __global float4* samples, unsigned int stride)
+{
+    unsigned int i = get_global_id(0);
+    
+    samples[i] = particles[i * stride].pos;
+}
+
+struct __attribute__ ((packed)) GlyphVertex {
+    float4 pos;
+    float4 colour;
+};
+
+__kernel void build_vector_field_glyphs(__global struct GlyphVertex* glyphs, __read_only image3d_t vector_field)
+{
+    unsigned int x = get_global_id(0);
+    unsigned int y = get_global_id(1);
+    unsigned int z = get_global_id(2);
+    unsigned int w = get_global_size(0);
+    unsigned int h = get_global_size(1);
+    unsigned int d = get_global_size(2);
+    
+    // Same sample lattice as the tessellated quiver: x/y across each slice, z across instances.
+    float4 uv = (float4)((float)x / (float)max(w - 1, 1u), (float)y / (float)max(h - 1, 1u), (float)z / (float)max(d - 1, 1u), 0.0f);
+    
+    // Half-voxel remap as in particle_simulation, so edge samples are not blended with the border.
+    float4 voxel = (float4)(1.0f / float(get_image_width(vector_field)) / 2.0f, 1.0f / float(get_image_height(vector_field)) / 2.0f, 1.0f / float(get_image_depth(vector_field)) / 2.0f, 0.0f);
+    
+    float4 colour = read_imagef(vector_field, vector_field_sampler, mix(voxel, (float4)(1.0f) - voxel, uv));
+    
+    float4 sample_pos = (float4)(-1.0f + 2.0f * uv.x, -1.0f + 2.0f * uv.y, 1.0f - 2.0f * uv.z, 1.0f);
+    
+    float4 voxel_force = (float4)(colour.xyz * 0.01f, 0.0f);
+    
+    float4 vector_point_pos = sample_pos + voxel_force;
+    float4 vector_arrow_tip = sample_pos + (float4)(0.0f, min(length(voxel_force), 0.5f), 0.0f, 0.0f);
+    
+    colour.w = 0.4f;
+    
+    __global struct GlyphVertex *glyph = &glyphs[((z * h + y) * w + x) * 4];
+    
+    glyph[0].pos = sample_pos;
+    glyph[1].pos = vector_point_pos;
+    glyph[2].pos = vector_point_pos;
+    glyph[3].pos = mix(vector_point_pos, vector_arrow_tip, 0.1f);
+    
+    for(int i = 0;i < 4;i++)
+        glyph[i].colour = colour;
+}
+
+#define STATISTICS_GROUP_SIZE 256
+#define STATISTICS_HISTOGRAM_BINS 32
+
+struct __attribute__ ((packed)) StatisticsPartial {
+    float speed_min;
+    float speed_max;
+    float speed_sum;
+    float life_ratio_min;
+    float life_ratio_max;
+    float life_ratio_sum;
+    uint inside_count;
+    uint particle_count;
+};
+
+struct __attribute__ ((packed)) ParticleStatistics {
+    float speed_min;
+    float speed_max;
+    float speed_mean;
+    float life_ratio_min;
+    float life_ratio_max;
+    float life_ratio_mean;
+    uint inside_count;
+    uint outside_count;
+    uint speed_histogram[STATISTICS_HISTOGRAM_BINS];
+    uint life_ratio_histogram[STATISTICS_HISTOGRAM_BINS];
+};
+
+__kernel __attribute__((reqd_work_group_size(STATISTICS_GROUP_SIZE, 1, 1)))
+void reduce_particle_statistics(__global struct Particle* particles, __constant struct BoundingBox* bounding_box, unsigned int particle_count, float histogram_max_speed, __global struct StatisticsPartial* partials, __global struct ParticleStatistics* statistics)
+{
+    __local float speed_min[STATISTICS_GROUP_SIZE];
+    __local float speed_max[STATISTICS_GROUP_SIZE];
+    __local float speed_sum[STATISTICS_GROUP_SIZE];
+    __local float life_ratio_min[STATISTICS_GROUP_SIZE];
+    __local float life_ratio_max[STATISTICS_GROUP_SIZE];
+    __local float life_ratio_sum[STATISTICS_GROUP_SIZE];
+    __local uint inside_count[STATISTICS_GROUP_SIZE];
+    
+    __local uint speed_histogram[STATISTICS_HISTOGRAM_BINS];
+    __local uint life_ratio_histogram[STATISTICS_HISTOGRAM_BINS];
+    
+    unsigned int i = get_global_id(0);
+    unsigned int l = get_local_id(0);
+    
+    if(l < STATISTICS_HISTOGRAM_BINS) {
+        speed_histogram[l] = 0;
+        life_ratio_histogram[l] = 0;
+    }
+    
+    barrier(CLK_LOCAL_MEM_FENCE);
+    
+    // Work items past the end contribute the identity of each reduction.
+    speed_min[l] = MAXFLOAT;
+    speed_max[l] = 0.0f;
+    speed_sum[l] = 0.0f;
+    life_ratio_min[l] = MAXFLOAT;
+    life_ratio_max[l] = 0.0f;
+    life_ratio_sum[l] = 0.0f;
+    inside_count[l] = 0;
+    
+    if(i < particle_count) {
+        
+        __global struct Particle *particle = &particles[i];
+        
+        float speed = length(particle->vel.xyz);
+        float life_ratio = particle->life.x / particle->life.y;
+        
+        float4 particle_pos_in_vector_field = (particle->pos - bounding_box->corner1) / (bounding_box->corner2 - bounding_box->corner1);
+        
+        speed_min[l] = speed_max[l] = speed_sum[l] = speed;
+        life_ratio_min[l] = life_ratio_max[l] = life_ratio_sum[l] = life_ratio;
+        inside_count[l] = is_between(0.0f, 1.0f, particle_pos_in_vector_field.x) * is_between(0.0f, 1.0f, particle_pos_in_vector_field.y) * is_between(0.0f, 1.0f, particle_pos_in_vector_field.z);
+        
+        atomic_inc(&speed_histogram[min((uint)(speed / histogram_max_speed * STATISTICS_HISTOGRAM_BINS), (uint)STATISTICS_HISTOGRAM_BINS - 1)]);
+        atomic_inc(&life_ratio_histogram[min((uint)(life_ratio * STATISTICS_HISTOGRAM_BINS), (uint)STATISTICS_HISTOGRAM_BINS - 1)]);
+    }
+    
+    barrier(CLK_LOCAL_MEM_FENCE);
+    
+    for(unsigned int stride = STATISTICS_GROUP_SIZE / 2;stride > 0;stride >>= 1) {
+        
+        if(l < stride) {
+            speed_min[l] = fmin(speed_min[l], speed_min[l + stride]);
+            speed_max[l] = fmax(speed_max[l], speed_max[l + stride]);
+            speed_sum[l] += speed_sum[l + stride];
+            life_ratio_min[l] = fmin(life_ratio_min[l], life_ratio_min[l + stride]);
+            life_ratio_max[l] = fmax(life_ratio_max[l], life_ratio_max[l + stride]);
+            life_ratio_sum[l] += life_ratio_sum[l + stride];
+            inside_count[l] += inside_count[l + stride];
+        }
+        
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    
+    if(l < STATISTICS_HISTOGRAM_BINS) {
+        atomic_add(&statistics->speed_histogram[l], speed_histogram[l]);
+        atomic_add(&statistics->life_ratio_histogram[l], life_ratio_histogram[l]);
+    }
+    
+    if(l == 0) {
+        
+        __global struct StatisticsPartial *partial = &partials[get_group_id(0)];
+        
+        partial->speed_min = speed_min[0];
+        partial->speed_max = speed_max[0];
+        partial->speed_sum = speed_sum[0];
+        partial->life_ratio_min = life_ratio_min[0];
+        partial->life_ratio_max = life_ratio_max[0];
+        partial->life_ratio_sum = life_ratio_sum[0];
+        partial->inside_count = inside_count[0];
+        partial->particle_count = min((uint)STATISTICS_GROUP_SIZE, particle_count - get_group_id(0) * STATISTICS_GROUP_SIZE);
+    }
+}
+
+// Run as a single work group to fold the per-group partials together.
+__kernel __attribute__((reqd_work_group_size(STATISTICS_GROUP_SIZE, 1, 1)))
+void finalize_particle_statistics(__global struct StatisticsPartial* partials, unsigned int number_of_partials, __global struct ParticleStatistics* statistics)
+{
+    __local float speed_min[STATISTICS_GROUP_SIZE];
+    __local float speed_max[STATISTICS_GROUP_SIZE];
+    __local float speed_sum[STATISTICS_GROUP_SIZE];
+    __local float life_ratio_min[STATISTICS_GROUP_SIZE];
+    __local float life_ratio_max[STATISTICS_GROUP_SIZE];
+    __local float life_ratio_sum[STATISTICS_GROUP_SIZE];
+    __local uint inside_count[STATISTICS_GROUP_SIZE];
+    __local uint particle_count[STATISTICS_GROUP_SIZE];
+    
+    unsigned int l = get_local_id(0);
+    
+    speed_min[l] = MAXFLOAT;
+    speed_max[l] = 0.0f;
+    speed_sum[l] = 0.0f;
+    life_ratio_min[l] = MAXFLOAT;
+    life_ratio_max[l] = 0.0f;
+    life_ratio_sum[l] = 0.0f;
+    inside_count[l] = 0;
+    particle_count[l] = 0;
+    
+    for(unsigned int i = l;i < number_of_partials;i += STATISTICS_GROUP_SIZE) {
+        speed_min[l] = fmin(speed_min[l], partials[i].speed_min);
+        speed_max[l] = fmax(speed_max[l], partials[i].speed_max);
+        speed_sum[l] += partials[i].speed_sum;
+        life_ratio_min[l] = fmin(life_ratio_min[l], partials[i].life_ratio_min);
+        life_ratio_max[l] = fmax(life_ratio_max[l], partials[i].life_ratio_max);
+        life_ratio_sum[l] += partials[i].life_ratio_sum;
+        inside_count[l] += partials[i].inside_count;
+        particle_count[l] += partials[i].particle_count;
+    }
+    
+    barrier(CLK_LOCAL_MEM_FENCE);
+    
+    for(unsigned int stride = STATISTICS_GROUP_SIZE / 2;stride > 0;stride >>= 1) {
+        
+        if(l < stride) {
+            speed_min[l] = fmin(speed_min[l], speed_min[l + stride]);
+            speed_max[l] = fmax(speed_max[l], speed_max[l + stride]);
+            speed_sum[l] += speed_sum[l + stride];
+            life_ratio_min[l] = fmin(life_ratio_min[l], life_ratio_min[l + stride]);
+            life_ratio_max[l] = fmax(life_ratio_max[l], life_ratio_max[l + stride]);
+            life_ratio_sum[l] += life_ratio_sum[l + stride];
+            inside_count[l] += inside_count[l + stride];
+            particle_count[l] += particle_count[l + stride];
+        }
+        
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    
+    if(l == 0) {
+        statistics->speed_min = speed_min[0];
+        statistics->speed_max = speed_max[0];
+        statistics->speed_mean = speed_sum[0] / max(particle_count[0], 1u);
+        statistics->life_ratio_min = life_ratio_min[0];
+        statistics->life_ratio_max = life_ratio_max[0];
+        statistics->life_ratio_mean = life_ratio_sum[0] / max(particle_count[0], 1u);
+        statistics->inside_count = inside_count[0];
+        statistics->outside_count = particle_count[0] - inside_count[0];
+    }
+}
+
+#define GRID_CACHE_SIZE 256
+#define GRID_CACHE_EMPTY 0xFFFFFFFF
+
+// Fixed point scale for velocity sums, OpenCL 1.2 has no float atomics.
+#define GRID_VELOCITY_SCALE 256.0f
+
+__kernel __attribute__((reqd_work_group_size(GRID_CACHE_SIZE, 1, 1)))
+void splat_particle_grid(__global struct Particle* particles, __constant struct BoundingBox* bounding_box, unsigned int particle_count, unsigned int grid_resolution, __global uint* grid_density, __global int* grid_velocity)
+{
+    // Direct mapped cache of grid cells, particles in a work group that land in the
+    // same cell are summed locally before a single global atomic per cell.
+    __local uint cache_cell[GRID_CACHE_SIZE];
+    __local uint cache_density[GRID_CACHE_SIZE];
+    __local int cache_velocity[GRID_CACHE_SIZE * 3];
+    
+    unsigned int i = get_global_id(0);
+    unsigned int l = get_local_id(0);
+    
+    cache_cell[l] = GRID_CACHE_EMPTY;
+    cache_density[l] = 0;
+    cache_velocity[l * 3] = 0;
+    cache_velocity[l * 3 + 1] = 0;
+    cache_velocity[l * 3 + 2] = 0;
+    
+    barrier(CLK_LOCAL_MEM_FENCE);
+    
+    if(i < particle_count) {
+        
+        __global struct Particle *particle = &particles[i];
+        
+        float4 particle_pos_in_vector_field = (particle->pos - bounding_box->corner1) / (bounding_box->corner2 - bounding_box->corner1);
+        
+        int is_inside_vector_field = is_between(0.0f, 1.0f, particle_pos_in_vector_field.x) * is_between(0.0f, 1.0f, particle_pos_in_vector_field.y) * is_between(0.0f, 1.0f, particle_pos_in_vector_field.z);
+        
+        if(is_inside_vector_field) {
+            
+            uint3 cell_coords = min(convert_uint3(particle_pos_in_vector_field.xyz * grid_resolution), (uint3)(grid_resolution - 1));
+            uint cell = (cell_coords.z * grid_resolution + cell_coords.y) * grid_resolution + cell_coords.x;
+            
+            int3 velocity = convert_int3(particle->vel.xyz * GRID_VELOCITY_SCALE);
+            
+            uint slot = cell % GRID_CACHE_SIZE;
+            uint previous_cell = atomic_cmpxchg(&cache_cell[slot], GRID_CACHE_EMPTY, cell);
+            
+            if(previous_cell == GRID_CACHE_EMPTY || previous_cell == cell) {
+                atomic_inc(&cache_density[slot]);
+                atomic_add(&cache_velocity[slot * 3], velocity.x);
+                atomic_add(&cache_velocity[slot * 3 + 1], velocity.y);
+                atomic_add(&cache_velocity[slot * 3 + 2], velocity.z);
+            }
+            else {
+                atomic_inc(&grid_density[cell]);
+                atomic_add(&grid_velocity[cell * 3], velocity.x);
+                atomic_add(&grid_velocity[cell * 3 + 1], velocity.y);
+                atomic_add(&grid_velocity[cell * 3 + 2], velocity.z);
+            }
+        }
+    }
+    
+    barrier(CLK_LOCAL_MEM_FENCE);
+    
+    uint cell = cache_cell[l];
+    
+    if(cell != GRID_CACHE_EMPTY) {
+        atomic_add(&grid_density[cell], cache_density[l]);
+        atomic_add(&grid_velocity[cell * 3], cache_velocity[l * 3]);
+        atomic_add(&grid_velocity[cell * 3 + 1], cache_velocity[l * 3 + 1]);
+        atomic_add(&grid_velocity[cell * 3 + 2], cache_velocity[l * 3 + 2]);
+    }
+}
+
+#pragma OPENCL EXTENSION cl_khr_3d_image_writes : enable
+
+// Writes mean velocity to xyz and density relative to a uniform distribution to w.
+__kernel void resolve_particle_grid(__global uint* grid_density, __global int* grid_velocity, unsigned int particle_count, __write_only image3d_t particle_grid)
+{
+    int4 coords = (int4)(get_global_id(0), get_global_id(1), get_global_id(2), 0);
+    
+    unsigned int grid_resolution = get_global_size(0);
+    unsigned int cell = (coords.z * grid_resolution + coords.y) * grid_resolution + coords.x;
+    
+    float density = (float)grid_density[cell];
+    float3 velocity = convert_float3(vload3(cell, grid_velocity)) / GRID_VELOCITY_SCALE / max(density, 1.0f);
+    
+    float relative_density = density * (float)(grid_resolution * grid_resolution * grid_resolution) / (float)max(particle_count, 1u);
+    
+    write_imagef(particle_grid, coords, (float4)(velocity, relative_density));
+}
+
+float3 closest_point_on_triangle(float3 p, float3 a, float3 b, float3 c)
+{
+    float3 ab = b - a;
+    float3 ac = c - a;
+    float3 ap = p - a;
+    
+    float d1 = dot(ab, ap);
+    float d2 = dot(ac, ap);
+    
+    if(d1 <= 0.0f && d2 <= 0.0f)
+        return a;
+    
+    float3 bp = p - b;
+    float d3 = dot(ab, bp);
+    float d4 = dot(ac, bp);
+    
+    if(d3 >= 0.0f && d4 <= d3)
+        return b;
+    
+    float vc = d1 * d4 - d3 * d2;
+    
+    if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+        return a + ab * (d1 / (d1 - d3));
+    
+    float3 cp = p - c;
+    float d5 = dot(ab, cp);
+    float d6 = dot(ac, cp);
+    
+    if(d6 >= 0.0f && d5 <= d6)
+        return c;
+    
+    float vb = d5 * d2 - d1 * d6;
+    
+    if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+        return a + ac * (d2 / (d2 - d6));
+    
+    float va = d3 * d6 - d5 * d4;
+    
+    if(va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    
+    float denominator = 1.0f / (va + vb + vc);
+    
+    return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+// Signed distance from each voxel centre to the obstacle triangles, in field coordinates.
+// The sign comes from the winding number, so meshes should be closed.
+__kernel void bake_obstacle_distance(__global float4* triangles, unsigned int triangle_count, __global float* distances)
+{
+    unsigned int x = get_global_id(0);
+    unsigned int y = get_global_id(1);
+    unsigned int z = get_global_id(2);
+    unsigned int resolution = get_global_size(0);
+    
+    float3 p = ((float3)(x, y, z) + 0.5f) / (float)resolution;
+    
+    float distance = MAXFLOAT;
+    float solid_angle = 0.0f;
+    
+    for(unsigned int i = 0;i < triangle_count;i++) {
+        
+        float3 a = triangles[i * 3].xyz;
+        float3 b = triangles[i * 3 + 1].xyz;
+        float3 c = triangles[i * 3 + 2].xyz;
+        
+        distance = fmin(distance, length(p - closest_point_on_triangle(p, a, b, c)));
+        
+        // Van Oosterom and Strackee.
+        float3 ra = a - p;
+        float3 rb = b - p;
+        float3 rc = c - p;
+        
+        float la = length(ra);
+        float lb = length(rb);
+        float lc = length(rc);
+        
+        float numerator = dot(ra, cross(rb, rc));
+        float denominator = la * lb * lc + dot(ra, rb) * lc + dot(rb, rc) * la + dot(rc, ra) * lb;
+        
+        solid_angle += 2.0f * atan2(numerator, denominator);
+    }
+    
+    int is_inside = fabs(solid_angle) > 2.0f * M_PI_F;
+    
+    distances[(z * resolution + y) * resolution + x] = triangle_count == 0 ? 1.0f : (is_inside ? -distance : distance);
+}
+
+__kernel void bake_obstacle_gradient(__global float* distances, __write_only image3d_t obstacles)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    int z = get_global_id(2);
+    int resolution = get_global_size(0);
+    int last = resolution - 1;
+    
+    #define DISTANCE(i, j, k) distances[(clamp(k, 0, last) * resolution + clamp(j, 0, last)) * resolution + clamp(i, 0, last)]
+    
+    float4 gradient = (float4)(
+        DISTANCE(x + 1, y, z) - DISTANCE(x - 1, y, z),
+        DISTANCE(x, y + 1, z) - DISTANCE(x, y - 1, z),
+        DISTANCE(x, y, z + 1) - DISTANCE(x, y, z - 1),
+        0.0f) * (resolution / 2.0f);
+    
+    gradient.w = DISTANCE(x, y, z);
+    
+    #undef DISTANCE
+    
+    write_imagef(obstacles, (int4)(x, y, z, 0), gradient);
+}
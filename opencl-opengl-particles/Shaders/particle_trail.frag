@@ -0,0 +1,10 @@
+#version 410
+
+in float fragment_alpha;
+
+out vec4 color;
+
+void main()
+{
+    color = vec4(1.0, 0.6, 0.2, 0.35 * fragment_alpha);
+}
@@ -0,0 +1,22 @@
+#version 410
+
+layout (location = 0) in vec4 position;
+
+uniform mat4 mvpMatrix;
+
+uniform int trail_length;
+uniform int trail_head;
+
+out float fragment_alpha;
+
+void main()
+{
+    // Two vertices per segment, trail_length segments per particle.
+    int slot = (gl_VertexID / 2) % trail_length;
+    int age = (trail_head - slot + trail_length) % trail_length;
+    
+    // w is zero for slots that have not been written yet.
+    fragment_alpha = position.w * (1.0 - float(age) / float(trail_length));
+    
+    gl_Position = mvpMatrix * vec4(position.xyz, 1.0);
+}
@@ -0,0 +1,52 @@
+#version 410
+
+in vec3 fragment_object_position;
+
+uniform mat4 model_matrix;
+
+uniform vec4 camera_world_position;
+
+uniform sampler3D tex;
+uniform float density_scale;
+
+out vec4 color;
+
+#define STEPS 96
+
+void main()
+{
+    // Only back faces are marched, so the volume still renders with the camera inside it.
+    if (gl_FrontFacing)
+        discard;
+    
+    vec3 camera_position = (inverse(model_matrix) * camera_world_position).xyz;
+    vec3 ray_direction = normalize(fragment_object_position - camera_position);
+    
+    // Ray against the [-1, 1] cube.
+    vec3 t0 = (vec3(-1.0) - camera_position) / ray_direction;
+    vec3 t1 = (vec3(1.0) - camera_position) / ray_direction;
+    vec3 t_min = min(t0, t1);
+    vec3 t_max = max(t0, t1);
+    
+    float t_near = max(max(max(t_min.x, t_min.y), t_min.z), 0.0);
+    float t_far = min(min(t_max.x, t_max.y), t_max.z);
+    
+    float step_size = (t_far - t_near) / float(STEPS);
+    
+    vec3 accumulated = vec3(0.0);
+    
+    for (int i = 0; i < STEPS; i++)
+    {
+        vec3 p = camera_position + ray_direction * (t_near + (float(i) + 0.5) * step_size);
+        
+        // Object space z runs from the front face at +1, texture depth from 0.
+        vec4 cell = texture(tex, vec3(p.x, p.y, -p.z) * 0.5 + 0.5);
+        
+        // Same colour ramp as the point sprites.
+        vec3 c = mix(vec3(0.0, 0.0, 0.0), vec3(0.04, 0.04, 0.09) * 2, min(length(cell.xyz), 1.0));
+        
+        accumulated += c * cell.w * density_scale * step_size;
+    }
+    
+    color = vec4(accumulated, 1.0);
+}
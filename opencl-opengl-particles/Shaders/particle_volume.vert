@@ -0,0 +1,14 @@
+#version 410
+
+layout (location = 0) in vec4 position;
+
+uniform mat4 mvpMatrix;
+
+out vec3 fragment_object_position;
+
+void main()
+{
+    fragment_object_position = position.xyz;
+    
+    gl_Position = mvpMatrix * position;
+}
@@ -0,0 +1,10 @@
+#version 410
+
+in vec4 fragment_colour;
+
+out vec4 color;
+
+void main()
+{
+    color = fragment_colour;
+}
@@ -0,0 +1,15 @@
+#version 410
+
+layout (location = 0) in vec4 position;
+layout (location = 1) in vec4 colour;
+
+uniform mat4 mvpMatrix;
+
+out vec4 fragment_colour;
+
+void main()
+{
+    fragment_colour = colour;
+    
+    gl_Position = mvpMatrix * position;
+}
@@ -0,0 +1,227 @@
+//
+//  SimulationCheckpoint.cpp
+//  opencl-opengl-particles
+//
+//
+
+#include "SimulationCheckpoint.hpp"
+#include "Utility.hpp"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+SimulationCheckpointWriter::~SimulationCheckpointWriter()
+{
+    if (m_writer_thread.joinable())
+        m_writer_thread.join();
+    
+    finish_write();
+}
+
+bool SimulationCheckpointWriter::write_async(std::string path, SimulationCheckpointHeader header, cl_command_queue cmd_queue, cl_mem particle_buffer, cl_mem rng_seed_buffer)
+{
+    if (is_writing()) {
+        printf("Checkpoint write already in progress, skipping %s\n", path.c_str());
+        return false;
+    }
+    
+    cl_int cl_error;
+    
+    m_cl_cmd_queue = cmd_queue;
+    
+    memcpy(header.magic, SIMULATION_CHECKPOINT_MAGIC, sizeof(SIMULATION_CHECKPOINT_MAGIC));
+    header.version = SIMULATION_CHECKPOINT_VERSION;
+    header.header_size = sizeof(SimulationCheckpointHeader);
+    header.particle_data_offset = sizeof(SimulationCheckpointHeader);
+    header.particle_data_size = (uint64_t) header.particle_count * header.floats_per_particle * sizeof(float);
+    header.rng_seed_data_offset = header.particle_data_offset + header.particle_data_size;
+    header.rng_seed_data_size = (uint64_t) header.particle_count * 2 * sizeof(cl_uint);
+    
+    size_t staging_size = header.particle_data_size + header.rng_seed_data_size;
+    
+    // Snapshot both buffers on the device so the simulation can carry on while the copy is written out.
+    m_cl_staging_buffer = OpenCLRuntime::get().acquire_buffer(CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, staging_size);
+    
+    if (m_cl_staging_buffer == NULL)
+        return false;
+    
+    CL_CHECK( clEnqueueCopyBuffer(cmd_queue, particle_buffer, m_cl_staging_buffer, 0, 0, header.particle_data_size, 0, NULL, NULL) );
+    CL_CHECK( clEnqueueCopyBuffer(cmd_queue, rng_seed_buffer, m_cl_staging_buffer, 0, header.particle_data_size, header.rng_seed_data_size, 0, NULL, NULL) );
+    
+    m_mapped_data = clEnqueueMapBuffer(cmd_queue, m_cl_staging_buffer, CL_FALSE, CL_MAP_READ, 0, staging_size, 0, NULL, &m_cl_map_event, &cl_error);
+    CL_CHECK(cl_error);
+    
+    clFlush(cmd_queue);
+    
+    m_is_writing = true;
+    
+    if (m_writer_thread.joinable())
+        m_writer_thread.join();
+    
+    m_writer_thread = std::thread(&SimulationCheckpointWriter::write_file, this, path, header);
+    
+    return true;
+}
+
+void SimulationCheckpointWriter::write_file(std::string path, SimulationCheckpointHeader header)
+{
+    clWaitForEvents(1, &m_cl_map_event);
+    
+    // Write to a temporary file first so a crash never leaves a truncated checkpoint behind.
+    std::string temporary_path = path + ".tmp";
+    
+    FILE *file = fopen(temporary_path.c_str(), "wb");
+    
+    if (file == NULL) {
+        printf("Failed to open checkpoint file %s\n", temporary_path.c_str());
+        m_is_writing = false;
+        return;
+    }
+    
+    size_t data_size = header.particle_data_size + header.rng_seed_data_size;
+    
+    bool is_written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(m_mapped_data, 1, data_size, file) == data_size;
+    
+    is_written = (fclose(file) == 0) && is_written;
+    
+    if (is_written && rename(temporary_path.c_str(), path.c_str()) == 0)
+        printf("Checkpoint written: %s (%u particles)\n", path.c_str(), header.particle_count);
+    else
+        printf("Failed to write checkpoint file %s\n", path.c_str());
+    
+    m_is_writing = false;
+}
+
+void SimulationCheckpointWriter::finish_write()
+{
+    if (m_cl_staging_buffer == NULL)
+        return;
+    
+    CL_CHECK( clEnqueueUnmapMemObject(m_cl_cmd_queue, m_cl_staging_buffer, m_mapped_data, 0, NULL, NULL) );
+    
+    clReleaseEvent(m_cl_map_event);
+    
+    // Pooled, so the next checkpoint of the same size reuses it.
+    m_cl_staging_buffer.reset();
+    
+    m_cl_map_event = NULL;
+    m_mapped_data = NULL;
+}
+
+void SimulationCheckpointWriter::update()
+{
+    if (m_is_writing || !m_writer_thread.joinable())
+        return;
+    
+    m_writer_thread.join();
+    
+    finish_write();
+}
+
+bool SimulationCheckpointWriter::is_writing()
+{
+    return m_is_writing || m_cl_staging_buffer != NULL;
+}
+
+SimulationCheckpointReader::~SimulationCheckpointReader()
+{
+    close();
+}
+
+bool SimulationCheckpointReader::open(std::string path)
+{
+    close();
+    
+    m_file_descriptor = ::open(path.c_str(), O_RDONLY);
+    
+    if (m_file_descriptor < 0) {
+        printf("Failed to open checkpoint file %s\n", path.c_str());
+        return false;
+    }
+    
+    struct stat file_stat;
+    
+    if (fstat(m_file_descriptor, &file_stat) != 0 || (size_t) file_stat.st_size < sizeof(SimulationCheckpointHeader)) {
+        printf("Checkpoint file %s is truncated\n", path.c_str());
+        close();
+        return false;
+    }
+    
+    m_mapped_size = file_stat.st_size;
+    m_mapped_data = mmap(NULL, m_mapped_size, PROT_READ, MAP_PRIVATE, m_file_descriptor, 0);
+    
+    if (m_mapped_data == MAP_FAILED) {
+        printf("Failed to map checkpoint file %s\n", path.c_str());
+        m_mapped_data = NULL;
+        close();
+        return false;
+    }
+    
+    const SimulationCheckpointHeader &header = get_header();
+    
+    if (memcmp(header.magic, SIMULATION_CHECKPOINT_MAGIC, sizeof(SIMULATION_CHECKPOINT_MAGIC)) != 0) {
+        printf("%s is not a checkpoint file\n", path.c_str());
+        close();
+        return false;
+    }
+    
+    if (header.version != SIMULATION_CHECKPOINT_VERSION || header.header_size != sizeof(SimulationCheckpointHeader)) {
+        printf("Unsupported checkpoint version %u in %s\n", header.version, path.c_str());
+        close();
+        return false;
+    }
+    
+    // The layout must be exactly what the writer produces. Sizes are checked against the remaining
+    // space rather than summed with the offsets, so values from a crafted file cannot wrap around.
+    if (header.floats_per_particle == 0 || header.floats_per_particle > SIMULATION_CHECKPOINT_MAX_FLOATS_PER_PARTICLE ||
+        header.particle_data_offset != sizeof(SimulationCheckpointHeader) ||
+        header.particle_data_size != (uint64_t) header.particle_count * header.floats_per_particle * sizeof(float) ||
+        header.rng_seed_data_offset != header.particle_data_offset + header.particle_data_size ||
+        header.rng_seed_data_size != (uint64_t) header.particle_count * 2 * sizeof(cl_uint) ||
+        header.particle_data_offset % sizeof(float) != 0 ||
+        header.rng_seed_data_offset % sizeof(cl_uint) != 0) {
+        printf("Checkpoint file %s has an invalid layout\n", path.c_str());
+        close();
+        return false;
+    }
+    
+    if (header.particle_data_offset > m_mapped_size || header.particle_data_size > m_mapped_size - header.particle_data_offset ||
+        header.rng_seed_data_offset > m_mapped_size || header.rng_seed_data_size > m_mapped_size - header.rng_seed_data_offset) {
+        printf("Checkpoint file %s is truncated\n", path.c_str());
+        close();
+        return false;
+    }
+    
+    return true;
+}
+
+void SimulationCheckpointReader::close()
+{
+    if (m_mapped_data != NULL)
+        munmap(m_mapped_data, m_mapped_size);
+    
+    if (m_file_descriptor >= 0)
+        ::close(m_file_descriptor);
+    
+    m_mapped_data = NULL;
+    m_mapped_size = 0;
+    m_file_descriptor = -1;
+}
+
+const SimulationCheckpointHeader &SimulationCheckpointReader::get_header()
+{
+    return *(const SimulationCheckpointHeader *) m_mapped_data;
+}
+
+const float *SimulationCheckpointReader::get_particle_data()
+{
+    return (const float *) ((const char *) m_mapped_data + get_header().particle_data_offset);
+}
+
+const cl_uint *SimulationCheckpointReader::get_rng_seed_data()
+{
+    return (const cl_uint *) ((const char *) m_mapped_data + get_header().rng_seed_data_offset);
+}
@@ -0,0 +1,111 @@
+//
+//  SimulationCheckpoint.hpp
+//  opencl-opengl-particles
+//
+//  Binary checkpoints of the particle simulation. Files are a fixed header
+//  followed by the raw particle buffer and the RNG seed buffer.
+//
+
+#ifndef SimulationCheckpoint_hpp
+#define SimulationCheckpoint_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <OpenCL/OpenCL.h>
+
+#include "OpenCLRuntime.hpp"
+
+#define SIMULATION_CHECKPOINT_MAGIC "PSCKPT"
+#define SIMULATION_CHECKPOINT_VERSION 3
+
+// Bounds the size arithmetic on untrusted headers, the particles themselves use 10.
+#define SIMULATION_CHECKPOINT_MAX_FLOATS_PER_PARTICLE 64
+
+struct SimulationCheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    
+    // Particle state.
+    uint32_t particle_count;
+    uint32_t floats_per_particle;
+    uint64_t particle_data_offset;
+    uint64_t particle_data_size;
+    uint64_t rng_seed_data_offset;
+    uint64_t rng_seed_data_size;
+    
+    // Simulation parameters.
+    float particle_tightness;
+    uint32_t field_sample_points_x;
+    uint32_t field_sample_points_y;
+    uint32_t field_sample_points_z;
+    uint32_t collision_mode;
+    float grid_coupling;
+    
+    // Vector field identity and transform.
+    float field_position[3];
+    float field_scale[3];
+    float field_orientation[4];
+    char field_path[256];
+};
+
+class SimulationCheckpointWriter
+{
+private:
+    
+    cl_command_queue m_cl_cmd_queue;
+    
+    CLBuffer m_cl_staging_buffer;
+    cl_event m_cl_map_event = NULL;
+    void *m_mapped_data = NULL;
+    
+    std::thread m_writer_thread;
+    std::atomic<bool> m_is_writing;
+    
+    void write_file(std::string path, SimulationCheckpointHeader header);
+    void finish_write();
+    
+public:
+    
+    SimulationCheckpointWriter()
+    {
+        m_is_writing = false;
+    }
+    
+    ~SimulationCheckpointWriter();
+    
+    // Copies the buffers on the device and writes them on a worker thread once mapped.
+    // The particle buffer must already be acquired from OpenGL.
+    bool write_async(std::string path, SimulationCheckpointHeader header, cl_command_queue cmd_queue, cl_mem particle_buffer, cl_mem rng_seed_buffer);
+    
+    // Called once a frame to unmap and release a completed write.
+    void update();
+    
+    bool is_writing();
+};
+
+class SimulationCheckpointReader
+{
+private:
+    
+    int m_file_descriptor = -1;
+    void *m_mapped_data = NULL;
+    size_t m_mapped_size = 0;
+    
+public:
+    
+    ~SimulationCheckpointReader();
+    
+    bool open(std::string path);
+    void close();
+    
+    const SimulationCheckpointHeader &get_header();
+    const float *get_particle_data();
+    const cl_uint *get_rng_seed_data();
+};
+
+#endif /* SimulationCheckpoint_hpp */
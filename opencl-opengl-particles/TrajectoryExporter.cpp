@@ -0,0 +1,290 @@
+//
+//  TrajectoryExporter.cpp
+//  opencl-opengl-particles
+//
+//
+
+#include "TrajectoryExporter.hpp"
+#include "Utility.hpp"
+
+#include <string.h>
+#include <math.h>
+
+TrajectoryExporter::~TrajectoryExporter()
+{
+    stop();
+    
+    if (m_cl_krnl_gather != NULL)
+        clReleaseKernel(m_cl_krnl_gather);
+}
+
+void TrajectoryExporter::create_kernels(cl_program program)
+{
+    cl_int cl_error;
+    
+    if (m_cl_krnl_gather != NULL)
+        clReleaseKernel(m_cl_krnl_gather);
+    
+    m_cl_krnl_gather = clCreateKernel(program, "gather_trajectory_samples", &cl_error);
+    CL_CHECK(cl_error);
+}
+
+bool TrajectoryExporter::start(std::string path, cl_command_queue cmd_queue, unsigned int particle_count, unsigned int sample_stride, unsigned int frame_interval, const float bounds_min[3], const float bounds_max[3])
+{
+    stop();
+    
+    if (sample_stride == 0 || frame_interval == 0)
+        return false;
+    
+    if (particle_count < sample_stride) {
+        printf("Not exporting trajectories, %u particles is fewer than the sample stride of %u\n", particle_count, sample_stride);
+        return false;
+    }
+    
+    m_file = fopen(path.c_str(), "wb");
+    
+    if (m_file == NULL) {
+        printf("Failed to open trajectory file %s\n", path.c_str());
+        return false;
+    }
+    
+    m_cl_cmd_queue = cmd_queue;
+    
+    memset(&m_file_header, 0, sizeof(m_file_header));
+    memcpy(m_file_header.magic, TRAJECTORY_FILE_MAGIC, sizeof(TRAJECTORY_FILE_MAGIC));
+    m_file_header.version = TRAJECTORY_FILE_VERSION;
+    m_file_header.header_size = sizeof(TrajectoryFileHeader);
+    m_file_header.particle_count = particle_count;
+    m_file_header.sample_stride = sample_stride;
+    m_file_header.sample_count = particle_count / sample_stride;
+    m_file_header.frame_interval = frame_interval;
+    m_file_header.keyframe_interval = TRAJECTORY_KEYFRAME_INTERVAL;
+    
+    for (int i = 0;i < 3;i++) {
+        m_file_header.bounds_min[i] = bounds_min[i];
+        m_file_header.bounds_max[i] = bounds_max[i];
+    }
+    
+    fwrite(&m_file_header, sizeof(m_file_header), 1, m_file);
+    
+    size_t samples_size = sizeof(float) * 4 * m_file_header.sample_count;
+    
+    cl_int cl_error;
+    
+    m_cl_sample_buffer = OpenCLRuntime::get().acquire_buffer(CL_MEM_READ_WRITE, samples_size);
+    
+    // Pinned host buffers, mapped once for the lifetime of the export.
+    m_staging_slots.resize(TRAJECTORY_RING_SIZE);
+    
+    for (unsigned int i = 0;i < TRAJECTORY_RING_SIZE;i++) {
+        StagingSlot &slot = m_staging_slots[i];
+        
+        slot.cl_host_buffer = OpenCLRuntime::get().acquire_buffer(CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, samples_size);
+        
+        slot.host_data = (float *) clEnqueueMapBuffer(cmd_queue, slot.cl_host_buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, samples_size, 0, NULL, NULL, &cl_error);
+        CL_CHECK(cl_error);
+        
+        slot.cl_read_event = NULL;
+        
+        m_free_slots.push_back(i);
+    }
+    
+    m_previous_quantized.assign(m_file_header.sample_count * 3, 0);
+    m_chunks_written = 0;
+    m_dropped_samples = 0;
+    
+    m_is_stopping = false;
+    m_is_exporting = true;
+    
+    m_writer_thread = std::thread(&TrajectoryExporter::write_loop, this);
+    
+    printf("Exporting trajectories of %u particles to %s\n", m_file_header.sample_count, path.c_str());
+    
+    return true;
+}
+
+void TrajectoryExporter::capture(cl_mem particle_buffer, unsigned int frame)
+{
+    if (!m_is_exporting || frame % m_file_header.frame_interval != 0)
+        return;
+    
+    unsigned int slot_index;
+    
+    {
+        std::lock_guard<std::mutex> lock(m_slot_mutex);
+        
+        // Never wait on the writer, drop the sample instead.
+        if (m_free_slots.empty()) {
+            m_dropped_samples++;
+            return;
+        }
+        
+        slot_index = m_free_slots.front();
+        m_free_slots.pop_front();
+    }
+    
+    StagingSlot &slot = m_staging_slots[slot_index];
+    slot.frame = frame;
+    
+    size_t global_work_size[] = {m_file_header.sample_count};
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_gather, 0, sizeof(particle_buffer), &particle_buffer) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_gather, 1, sizeof(cl_mem), m_cl_sample_buffer.get_address()) );
+    
+    CL_CHECK( clSetKernelArg(m_cl_krnl_gather, 2, sizeof(cl_uint), &m_file_header.sample_stride) );
+    
+    CL_CHECK( clEnqueueNDRangeKernel(m_cl_cmd_queue, m_cl_krnl_gather, 1, NULL, global_work_size, NULL, 0, 0, 0) );
+    
+    m_gathered_slot = slot_index;
+}
+
+void TrajectoryExporter::submit_readback()
+{
+    if (m_gathered_slot < 0)
+        return;
+    
+    StagingSlot &slot = m_staging_slots[m_gathered_slot];
+    
+    CL_CHECK( clEnqueueReadBuffer(m_cl_cmd_queue, m_cl_sample_buffer, CL_FALSE, 0, sizeof(float) * 4 * m_file_header.sample_count, slot.host_data, 0, NULL, &slot.cl_read_event) );
+    
+    clFlush(m_cl_cmd_queue);
+    
+    {
+        std::lock_guard<std::mutex> lock(m_slot_mutex);
+        
+        m_pending_slots.push_back(m_gathered_slot);
+    }
+    
+    m_gathered_slot = -1;
+    
+    m_slot_condition.notify_one();
+}
+
+void TrajectoryExporter::write_loop()
+{
+    while (true) {
+        
+        unsigned int slot_index;
+        
+        {
+            std::unique_lock<std::mutex> lock(m_slot_mutex);
+            
+            m_slot_condition.wait(lock, [this]{ return m_is_stopping || !m_pending_slots.empty(); });
+            
+            if (m_pending_slots.empty())
+                return;
+            
+            slot_index = m_pending_slots.front();
+            m_pending_slots.pop_front();
+        }
+        
+        StagingSlot &slot = m_staging_slots[slot_index];
+        
+        clWaitForEvents(1, &slot.cl_read_event);
+        clReleaseEvent(slot.cl_read_event);
+        slot.cl_read_event = NULL;
+        
+        write_chunk(slot);
+        
+        {
+            std::lock_guard<std::mutex> lock(m_slot_mutex);
+            
+            m_free_slots.push_back(slot_index);
+        }
+    }
+}
+
+static void write_varint(std::vector<uint8_t> &payload, uint32_t value)
+{
+    while (value >= 0x80) {
+        payload.push_back((uint8_t) (value | 0x80));
+        value >>= 7;
+    }
+    
+    payload.push_back((uint8_t) value);
+}
+
+void TrajectoryExporter::write_chunk(const StagingSlot &slot)
+{
+    bool is_keyframe = m_chunks_written % TRAJECTORY_KEYFRAME_INTERVAL == 0;
+    
+    m_payload.clear();
+    
+    for (unsigned int i = 0;i < m_file_header.sample_count;i++) {
+        for (unsigned int axis = 0;axis < 3;axis++) {
+            
+            float range = m_file_header.bounds_max[axis] - m_file_header.bounds_min[axis];
+            float normalized = (slot.host_data[i * 4 + axis] - m_file_header.bounds_min[axis]) / range;
+            
+            normalized = fminf(fmaxf(normalized, 0.0f), 1.0f);
+            
+            uint16_t quantized = (uint16_t) (normalized * 65535.0f + 0.5f);
+            uint16_t &previous = m_previous_quantized[i * 3 + axis];
+            
+            int16_t delta = (int16_t) (quantized - (is_keyframe ? 0 : previous));
+            
+            // Zigzag so small negative deltas also encode to a single byte.
+            write_varint(m_payload, (((uint32_t) delta << 1) ^ (uint32_t) (delta >> 15)) & 0xFFFF);
+            
+            previous = quantized;
+        }
+    }
+    
+    TrajectoryChunkHeader chunk_header;
+    memcpy(chunk_header.magic, TRAJECTORY_CHUNK_MAGIC, sizeof(chunk_header.magic));
+    chunk_header.frame = slot.frame;
+    chunk_header.is_keyframe = is_keyframe;
+    chunk_header.payload_size = (uint32_t) m_payload.size();
+    
+    fwrite(&chunk_header, sizeof(chunk_header), 1, m_file);
+    fwrite(m_payload.data(), 1, m_payload.size(), m_file);
+    
+    // Keep the file readable up to the last whole chunk if the app goes down mid export.
+    fflush(m_file);
+    
+    m_chunks_written++;
+}
+
+void TrajectoryExporter::stop()
+{
+    if (!m_is_exporting)
+        return;
+    
+    submit_readback();
+    
+    {
+        std::lock_guard<std::mutex> lock(m_slot_mutex);
+        
+        m_is_stopping = true;
+    }
+    
+    m_slot_condition.notify_one();
+    
+    // The writer drains every pending chunk before it exits.
+    m_writer_thread.join();
+    
+    for (StagingSlot &slot : m_staging_slots)
+        clEnqueueUnmapMemObject(m_cl_cmd_queue, slot.cl_host_buffer, slot.host_data, 0, NULL, NULL);
+    
+    clFinish(m_cl_cmd_queue);
+    
+    // Back to the runtime's pool, a restarted export of the same size reuses them.
+    m_cl_sample_buffer.reset();
+    
+    m_staging_slots.clear();
+    m_free_slots.clear();
+    m_pending_slots.clear();
+    
+    fclose(m_file);
+    m_file = NULL;
+    
+    m_is_exporting = false;
+    
+    printf("Trajectory export finished: %u chunks written, %u dropped\n", m_chunks_written, m_dropped_samples);
+}
+
+bool TrajectoryExporter::is_exporting()
+{
+    return m_is_exporting;
+}
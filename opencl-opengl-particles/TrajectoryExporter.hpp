@@ -0,0 +1,126 @@
+//
+//  TrajectoryExporter.hpp
+//  opencl-opengl-particles
+//
+//  Streams positions of a subset of particles to disk. Positions are
+//  gathered on the device, read back into a ring of pinned buffers without
+//  blocking and compressed on a writer thread.
+//
+//  File layout: a TrajectoryFileHeader followed by chunks, each a
+//  TrajectoryChunkHeader and a payload of zigzag varints. Every value is a
+//  16 bit position quantized across the header bounds, stored as a delta
+//  from the previous chunk, or from zero for keyframes.
+//
+
+#ifndef TrajectoryExporter_hpp
+#define TrajectoryExporter_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <OpenCL/OpenCL.h>
+
+#include "OpenCLRuntime.hpp"
+
+#define TRAJECTORY_FILE_MAGIC "PTRAJ"
+#define TRAJECTORY_CHUNK_MAGIC "TRJC"
+#define TRAJECTORY_FILE_VERSION 1
+
+// Number of pinned readback buffers in flight.
+#define TRAJECTORY_RING_SIZE 4
+
+// Write an absolute chunk every this many chunks.
+#define TRAJECTORY_KEYFRAME_INTERVAL 64
+
+struct TrajectoryFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t particle_count;
+    uint32_t sample_stride;
+    uint32_t sample_count;
+    uint32_t frame_interval;
+    uint32_t keyframe_interval;
+    float bounds_min[3];
+    float bounds_max[3];
+};
+
+struct TrajectoryChunkHeader
+{
+    char magic[4];
+    uint32_t frame;
+    uint32_t is_keyframe;
+    uint32_t payload_size;
+};
+
+class TrajectoryExporter
+{
+private:
+    
+    struct StagingSlot
+    {
+        CLBuffer cl_host_buffer;
+        float *host_data;
+        cl_event cl_read_event;
+        unsigned int frame;
+    };
+    
+    cl_command_queue m_cl_cmd_queue;
+    cl_kernel m_cl_krnl_gather = NULL;
+    
+    CLBuffer m_cl_sample_buffer;
+    
+    std::vector<StagingSlot> m_staging_slots;
+    std::deque<unsigned int> m_free_slots;
+    std::deque<unsigned int> m_pending_slots;
+    
+    int m_gathered_slot = -1;
+    
+    std::mutex m_slot_mutex;
+    std::condition_variable m_slot_condition;
+    std::thread m_writer_thread;
+    
+    FILE *m_file = NULL;
+    TrajectoryFileHeader m_file_header;
+    
+    bool m_is_exporting = false;
+    bool m_is_stopping = false;
+    
+    unsigned int m_chunks_written = 0;
+    unsigned int m_dropped_samples = 0;
+    
+    std::vector<uint16_t> m_previous_quantized;
+    std::vector<uint8_t> m_payload;
+    
+    void write_loop();
+    void write_chunk(const StagingSlot &slot);
+    
+public:
+    
+    ~TrajectoryExporter();
+    
+    // Exports every sample_stride'th particle, every frame_interval'th frame.
+    // (Re)creates the gather kernel, must be called before the first export.
+    void create_kernels(cl_program program);
+    
+    bool start(std::string path, cl_command_queue cmd_queue, unsigned int particle_count, unsigned int sample_stride, unsigned int frame_interval, const float bounds_min[3], const float bounds_max[3]);
+    
+    // Gathers the sampled particles on the device. Must be called with the particle buffer acquired from OpenGL.
+    void capture(cl_mem particle_buffer, unsigned int frame);
+    
+    // Queues the non-blocking readback of the last capture. Call once the frame's
+    // command queue has been waited on, so the transfer overlaps the next frame.
+    void submit_readback();
+    
+    void stop();
+    
+    bool is_exporting();
+};
+
+#endif /* TrajectoryExporter_hpp */
@@ -0,0 +1,291 @@
+//
+//  VectorFieldLibrary.cpp
+//  opencl-opengl-particles
+//
+//
+
+#include "VectorFieldLibrary.hpp"
+#include "Utility.hpp"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <math.h>
+
+VectorFieldLibrary::~VectorFieldLibrary()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+        
+        m_is_stopping = true;
+    }
+    
+    m_prefetch_condition.notify_one();
+    
+    if (m_prefetch_thread.joinable())
+        m_prefetch_thread.join();
+    
+    for (auto &field : m_fields) {
+        clReleaseMemObject(field.second.cl_image);
+        glDeleteTextures(1, &field.second.texture_id);
+    }
+}
+
+void VectorFieldLibrary::initialize(cl_context context)
+{
+    m_cl_context = context;
+    
+    m_prefetch_thread = std::thread(&VectorFieldLibrary::prefetch_loop, this);
+    
+    for (const std::string &path : m_paths)
+        prefetch(path);
+}
+
+void VectorFieldLibrary::prefetch_loop()
+{
+    while (true) {
+        
+        std::string path;
+        
+        {
+            std::unique_lock<std::mutex> lock(m_prefetch_mutex);
+            
+            m_prefetch_condition.wait(lock, [this]{ return m_is_stopping || !m_read_queue.empty(); });
+            
+            if (m_is_stopping)
+                return;
+            
+            path = m_read_queue.front();
+            m_read_queue.pop_front();
+        }
+        
+        FieldData data;
+        
+        if (!parse(path, data))
+            continue;
+        
+        std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+        
+        m_upload_queue.push_back(std::move(data));
+    }
+}
+
+bool VectorFieldLibrary::parse(std::string path, FieldData &data)
+{
+    std::string source = utility::load_file(path);
+    
+    // Comma separated: the dimensions, the minimum and maximum bounds, then one vector per voxel with x fastest.
+    std::vector<GLfloat> values;
+    
+    const char *cursor = source.c_str();
+    
+    while (*cursor != '\0') {
+        char *end;
+        float value = strtof(cursor, &end);
+        
+        if (end == cursor) {
+            cursor++;
+            continue;
+        }
+        
+        values.push_back(value);
+        cursor = end;
+    }
+    
+    data.path = path;
+    data.width = data.height = data.depth = 0;
+    
+    size_t first_vector = 9;
+    
+    if (values.size() >= 9 && values[0] >= 1.0f && values[1] >= 1.0f && values[2] >= 1.0f &&
+        values.size() - 9 == (size_t) values[0] * (size_t) values[1] * (size_t) values[2] * 3) {
+        data.width = (GLsizei) values[0];
+        data.height = (GLsizei) values[1];
+        data.depth = (GLsizei) values[2];
+    }
+    else {
+        // Headerless files are a cube of vectors. Some keep the nine header slots with vectors in them, which are skipped.
+        // The bounds are not needed either way, the field is always mapped onto the unit cube.
+        for (size_t skip : {(size_t) 0, (size_t) 9}) {
+            
+            if (values.size() <= skip || (values.size() - skip) % 3 != 0)
+                continue;
+            
+            size_t count = (values.size() - skip) / 3;
+            GLsizei side = (GLsizei) lround(cbrt((double) count));
+            
+            if ((size_t) side * side * side == count) {
+                data.width = data.height = data.depth = side;
+                first_vector = skip;
+                break;
+            }
+        }
+    }
+    
+    if (data.width <= 0) {
+        printf("Error: %s is not a vector field, expected an FGA header or a cube of vectors\n", path.c_str());
+        return false;
+    }
+    
+    data.texels.resize((size_t) data.width * data.height * data.depth * 4);
+    
+    for (size_t i = 0;i < data.texels.size() / 4;i++) {
+        data.texels[i * 4 + 0] = values[first_vector + i * 3 + 0];
+        data.texels[i * 4 + 1] = values[first_vector + i * 3 + 1];
+        data.texels[i * 4 + 2] = values[first_vector + i * 3 + 2];
+        data.texels[i * 4 + 3] = 0.0f;
+    }
+    
+    return true;
+}
+
+bool VectorFieldLibrary::is_queued(std::string path)
+{
+    if (std::find(m_read_queue.begin(), m_read_queue.end(), path) != m_read_queue.end())
+        return true;
+    
+    for (const FieldData &data : m_upload_queue)
+        if (data.path == path)
+            return true;
+    
+    return false;
+}
+
+void VectorFieldLibrary::prefetch(std::string path)
+{
+    if (is_resident(path))
+        return;
+    
+    {
+        std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+        
+        if (is_queued(path))
+            return;
+        
+        m_read_queue.push_back(path);
+    }
+    
+    m_prefetch_condition.notify_one();
+}
+
+void VectorFieldLibrary::update()
+{
+    FieldData data;
+    
+    {
+        std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+        
+        if (m_upload_queue.empty())
+            return;
+        
+        data = std::move(m_upload_queue.front());
+        m_upload_queue.pop_front();
+    }
+    
+    if (is_resident(data.path))
+        return;
+    
+    upload(data);
+    
+    // A prefetched field goes to the back, so it is the first to make room again.
+    m_lru.remove(data.path);
+    m_lru.push_back(data.path);
+    
+    evict_to_budget();
+}
+
+void VectorFieldLibrary::upload(FieldData &data)
+{
+    VectorField field;
+    
+    glGenTextures(1, &field.texture_id);
+    glBindTexture(GL_TEXTURE_3D, field.texture_id);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F, data.width, data.height, data.depth, 0, GL_RGBA, GL_FLOAT, data.texels.data());
+    glBindTexture(GL_TEXTURE_3D, 0);
+    
+    field.size = data.texels.size() * sizeof(GLfloat);
+    
+    cl_int cl_error;
+    
+    field.cl_image = clCreateFromGLTexture(m_cl_context, CL_MEM_READ_WRITE, GL_TEXTURE_3D, 0, field.texture_id, &cl_error);
+    CL_CHECK(cl_error);
+    
+    m_fields[data.path] = field;
+    m_memory_used += field.size;
+    
+    m_lru.push_front(data.path);
+    
+    printf("Loaded vector field %s (%d x %d x %d), %zu of %zu bytes used\n", data.path.c_str(), data.width, data.height, data.depth, m_memory_used, m_memory_budget);
+}
+
+void VectorFieldLibrary::touch(std::string path)
+{
+    m_lru.remove(path);
+    m_lru.push_front(path);
+}
+
+void VectorFieldLibrary::evict_to_budget()
+{
+    std::list<std::string>::iterator it = m_lru.end();
+    
+    while (m_memory_used > m_memory_budget && it != m_lru.begin()) {
+        
+        --it;
+        
+        // The active field is bound to the kernel and material, never evict it.
+        if (*it == m_active_path)
+            continue;
+        
+        VectorField &field = m_fields[*it];
+        
+        // Deferred by OpenCL until commands using the image have finished.
+        clReleaseMemObject(field.cl_image);
+        glDeleteTextures(1, &field.texture_id);
+        
+        m_memory_used -= field.size;
+        
+        printf("Evicted vector field %s\n", it->c_str());
+        
+        m_fields.erase(*it);
+        it = m_lru.erase(it);
+    }
+}
+
+const VectorFieldLibrary::VectorField *VectorFieldLibrary::acquire(std::string path)
+{
+    if (!is_resident(path)) {
+        FieldData data;
+        
+        // A miss has to parse on the render thread.
+        if (!parse(path, data))
+            return NULL;
+        
+        upload(data);
+    }
+    
+    m_active_path = path;
+    
+    touch(path);
+    evict_to_budget();
+    
+    return &m_fields[path];
+}
+
+bool VectorFieldLibrary::is_resident(std::string path)
+{
+    return m_fields.find(path) != m_fields.end();
+}
+
+const std::vector<std::string> &VectorFieldLibrary::get_paths()
+{
+    return m_paths;
+}
+
+size_t VectorFieldLibrary::get_memory_used()
+{
+    return m_memory_used;
+}
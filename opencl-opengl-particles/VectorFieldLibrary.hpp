@@ -0,0 +1,109 @@
+//
+//  VectorFieldLibrary.hpp
+//  opencl-opengl-particles
+//
+//  Keeps a set of vector fields resident on the device as 3D textures
+//  shared with OpenCL, evicting the least recently used fields once a
+//  memory budget is exceeded.
+//
+//  Prefetching reads and parses field files on a worker thread. The texture
+//  upload needs the GL context, so update() uploads at most one prefetched
+//  field per frame on the render thread.
+//
+
+#ifndef VectorFieldLibrary_hpp
+#define VectorFieldLibrary_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <GL/glew.h>
+#include <OpenCL/OpenCL.h>
+
+class VectorFieldLibrary
+{
+public:
+    
+    struct VectorField
+    {
+        GLuint texture_id;
+        cl_mem cl_image;
+        size_t size;
+    };
+    
+private:
+    
+    // A field file parsed into RGBA texels, ready for glTexImage3D.
+    struct FieldData
+    {
+        std::string path;
+        GLsizei width, height, depth;
+        std::vector<GLfloat> texels;
+    };
+    
+    cl_context m_cl_context;
+    
+    std::vector<std::string> m_paths;
+    
+    size_t m_memory_budget;
+    size_t m_memory_used = 0;
+    
+    std::string m_active_path;
+    
+    std::map<std::string, VectorField> m_fields;
+    
+    // Most recently used at the front.
+    std::list<std::string> m_lru;
+    
+    std::thread m_prefetch_thread;
+    std::mutex m_prefetch_mutex;
+    std::condition_variable m_prefetch_condition;
+    
+    std::deque<std::string> m_read_queue;
+    std::deque<FieldData> m_upload_queue;
+    
+    bool m_is_stopping = false;
+    
+    void prefetch_loop();
+    
+    static bool parse(std::string path, FieldData &data);
+    void upload(FieldData &data);
+    bool is_queued(std::string path);
+    void touch(std::string path);
+    void evict_to_budget();
+    
+public:
+    
+    VectorFieldLibrary(std::vector<std::string> paths, size_t memory_budget)
+    {
+        m_paths = paths;
+        m_memory_budget = memory_budget;
+    }
+    
+    ~VectorFieldLibrary();
+    
+    // Starts the prefetch worker and queues every field in the library for preloading.
+    void initialize(cl_context context);
+    
+    // Returns the field, loading it synchronously on a miss, and makes it the active field.
+    // NULL if the file cannot be parsed, the active field is left unchanged.
+    const VectorField *acquire(std::string path);
+    
+    void prefetch(std::string path);
+    
+    // Uploads at most one prefetched field, call once a frame.
+    void update();
+    
+    bool is_resident(std::string path);
+    
+    const std::vector<std::string> &get_paths();
+    size_t get_memory_used();
+};
+
+#endif /* VectorFieldLibrary_hpp */
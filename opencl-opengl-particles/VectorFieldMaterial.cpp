@@ -9,6 +9,11 @@
 #include "VectorFieldMaterial.hpp"
 #include "Mesh.hpp"
 
+void VectorFieldMaterial::set_vector_field_texture(GLuint vector_field_texture_id)
+{
+    m_vector_field_texture_id = vector_field_texture_id;
+}
+
 void VectorFieldMaterial::set_field_sample_points_x(unsigned int sample_points)
 {
     m_sample_points_x = sample_points;
@@ -33,7 +38,7 @@ void VectorFieldMaterial::apply(std::shared_ptr<Object> object, std::shared_ptr<
 {
     Material::apply(object, camera);
     
-    m_vector_field_texture->bind_texture();
+    glBindTexture(GL_TEXTURE_3D, m_vector_field_texture_id);
         
     m_shader->set_uniform("field_sample_points_x", m_sample_points_x);
     m_shader->set_uniform("field_sample_points_y", m_sample_points_y);
@@ -12,26 +12,27 @@
 #include <stdio.h>
 
 #include "Material.hpp"
-#include "Texture.hpp"
 
 class VectorFieldMaterial : public Material
 {
 private:
     
-    std::shared_ptr<Texture> m_vector_field_texture;
+    GLuint m_vector_field_texture_id;
     
     unsigned int m_sample_points_x;
     unsigned int m_sample_points_y;
     
 public:
     
-    VectorFieldMaterial(std::shared_ptr<Shader> shader, std::shared_ptr<Texture> vector_field_texture) : Material(shader)
+    VectorFieldMaterial(std::shared_ptr<Shader> shader, GLuint vector_field_texture_id) : Material(shader)
     {
-        m_vector_field_texture = vector_field_texture;
+        m_vector_field_texture_id = vector_field_texture_id;
         m_sample_points_x = 2;
         m_sample_points_y = 2;
     }
     
+    void set_vector_field_texture(GLuint vector_field_texture_id);
+    
     void set_field_sample_points_x(unsigned int sample_points);
     void set_field_sample_points_y(unsigned int sample_points);
     
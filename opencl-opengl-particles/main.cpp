@@ -24,9 +24,13 @@
 
 #include <vector>
 #include <map>
+#include <thread>
+#include <climits>
 
 #include "Scene.hpp"
 #include "Scenes/ParticleScene.hpp"
+#include "OpenCLRuntime.hpp"
+#include "FrameRecorder.hpp"
 
 // Function prototypes
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode);
@@ -46,8 +50,57 @@ nanogui::Screen* gui_screen;
 std::unique_ptr<Scene> current_scene;
 
 // The MAIN function, from here we start the application and run the game loop
-int main()
+// Pass --record <file> to record the session, or --replay <file> to replay one headless.
+// Pass --render <path prefix> to render offline into an image sequence, with --frames <n>,
+// --size <width>x<height>, --time-step <seconds> and --encode-threads <n>.
+int main(int argc, char *argv[])
 {
+    std::string record_path;
+    std::string replay_path;
+    std::string render_path_prefix;
+    
+    unsigned int render_width = 1920, render_height = 1080;
+    unsigned int frame_count = 0;
+    unsigned int encode_threads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    double time_step = 1.0 / 60.0;
+    
+    for (int i = 1; i + 1 < argc; i++) {
+        
+        if (std::string(argv[i]) == "--record")
+            record_path = argv[++i];
+        
+        else if (std::string(argv[i]) == "--replay")
+            replay_path = argv[++i];
+        
+        else if (std::string(argv[i]) == "--render")
+            render_path_prefix = argv[++i];
+        
+        else if (std::string(argv[i]) == "--frames")
+            frame_count = (unsigned int) atoi(argv[++i]);
+        
+        else if (std::string(argv[i]) == "--size")
+            sscanf(argv[++i], "%ux%u", &render_width, &render_height);
+        
+        else if (std::string(argv[i]) == "--time-step")
+            time_step = atof(argv[++i]);
+        
+        else if (std::string(argv[i]) == "--encode-threads")
+            encode_threads = (unsigned int) atoi(argv[++i]);
+    }
+    
+    bool is_replaying = !replay_path.empty();
+    bool is_rendering = !render_path_prefix.empty();
+    
+    // A scene has one session, it either records or replays.
+    if (is_replaying && !record_path.empty()) {
+        std::cout << "--record cannot be combined with --replay" << std::endl;
+        return -1;
+    }
+    
+    // A replay runs to its end unless told otherwise.
+    if (frame_count == 0)
+        frame_count = is_replaying ? UINT_MAX : 300;
+    
     std::cout << "Starting GLFW context" << std::endl;
     // Init GLFW
     glfwInit();
@@ -60,6 +113,10 @@ int main()
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
     glfwWindowHint(GLFW_REFRESH_RATE, 30);
     
+    // Headless runs still need a GL context for the OpenCL sharing, just not a visible one.
+    if (is_replaying || is_rendering)
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    
     // Create a GLFWwindow object that we can use for GLFW's functions
     GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "LearnOpenGL", nullptr, nullptr);
     if (window == nullptr)
@@ -105,21 +162,88 @@ int main()
 
     nanogui::Button *b = new nanogui::Button(popup, "Basic scene");
     b->setCallback([&]{
+        current_scene.reset();
         current_scene = std::unique_ptr<Scene>(new Scene(width, height));
         current_scene->initialize(gui_screen);
     });
     
     b = new nanogui::Button(popup, "OpenCL scene");
     b->setCallback([&]{
+        // Release the old scene first so its pooled buffers are there for the new one.
+        current_scene.reset();
         current_scene = std::unique_ptr<Scene>(new ParticleScene(width, height));
         current_scene->initialize(gui_screen);
+        gui_screen->performLayout();
+        
+        OpenCLRuntime::get().print_statistics();
     });
     
-    current_scene = std::unique_ptr<ParticleScene>(new ParticleScene(width, height));
+    // Offline renders size the camera for the output, not the window.
+    ParticleScene *particle_scene = is_rendering ? new ParticleScene(render_width, render_height) : new ParticleScene(width, height);
+    
+    if (is_replaying && !particle_scene->replay_session(replay_path)) {
+        glfwTerminate();
+        return -1;
+    }
+    
+    if (!record_path.empty())
+        particle_scene->record_session(record_path);
+    
+    current_scene = std::unique_ptr<ParticleScene>(particle_scene);
     current_scene->initialize(gui_screen);
     
     gui_screen->performLayout();
     
+    // Headless replay and offline rendering, as fast as it goes with recorded or fixed frame times.
+    if (is_replaying || is_rendering) {
+        
+        std::unique_ptr<FrameRecorder> frame_recorder;
+        
+        if (is_rendering) {
+            
+            particle_scene->set_fixed_time_step(time_step);
+            
+            frame_recorder = std::unique_ptr<FrameRecorder>(new FrameRecorder(render_width, render_height, render_path_prefix));
+            
+            if (!frame_recorder->initialize(encode_threads)) {
+                current_scene.reset();
+                OpenCLRuntime::get().release();
+                glfwTerminate();
+                return -1;
+            }
+        }
+        
+        double start_time = glfwGetTime();
+        unsigned int headless_frames = 0;
+        
+        while (headless_frames < frame_count && !particle_scene->is_session_finished()) {
+            
+            if (frame_recorder)
+                frame_recorder->begin_frame();
+            
+            current_scene->draw();
+            
+            if (frame_recorder)
+                frame_recorder->end_frame();
+            
+            headless_frames++;
+        }
+        
+        double headless_time = glfwGetTime() - start_time;
+        unsigned int checksum_mismatches = particle_scene->get_session_checksum_mismatches();
+        
+        printf("Ran %u frames headless in %f s [%f FPS]\n", headless_frames, headless_time, headless_frames / headless_time);
+        
+        if (frame_recorder)
+            frame_recorder->finish();
+        
+        current_scene.reset();
+        OpenCLRuntime::get().release();
+        
+        glfwTerminate();
+        return checksum_mismatches == 0 ? 0 : 1;
+    }
+    
     // Game loop
     while (!glfwWindowShouldClose(window))
     {
@@ -155,6 +279,10 @@ int main()
         }
     }
     
+    // OpenCL objects shared with OpenGL must go before the context does.
+    current_scene.reset();
+    OpenCLRuntime::get().release();
+    
     // Terminate GLFW, clearing any resources allocated by GLFW.
     glfwTerminate();
     return 0;